@@ -1,5 +1,26 @@
 #include "buffer.h"
 
+/**
+ * Initialize an empty buffer able to hold sequence numbers spanning at least the given capacity.
+ *
+ * @param   buffer      Pointer to buffer
+ * @param   capacity    Minimum capacity (rounded up to a power of two)
+ * @param   pool        Pool of sizeof(buffer_node_t) blocks to take the nodes from
+*/
+void buffer_init(buffer_t *buffer, uint32_t capacity, pool_t *pool) {
+    uint32_t slots = 1;
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+    buffer->slots = xmalloc(slots * sizeof(buffer_node_t*));
+    memset(buffer->slots, 0, slots * sizeof(buffer_node_t*));
+    buffer->mask = slots - 1;
+    buffer->first = 0;
+    buffer->last = 0;
+    buffer->size = 0;
+    buffer->pool = pool;
+}
+
 /**
  * Get the first buffer node (lowest sequence number).
  *
@@ -8,7 +29,44 @@
  * @return  Pointer to first buffer node (NULL if none)
 */
 buffer_node_t* buffer_get_first(buffer_t *buffer) {
-    return buffer->head;
+    if (buffer->size == 0) {
+        return NULL;
+    }
+    return buffer->slots[buffer->first & buffer->mask];
+}
+
+/**
+ * Get the buffer node following the given one (next higher sequence number).
+ *
+ * @param   buffer      Pointer to buffer
+ * @param   node        Pointer to a buffer node in the buffer
+ *
+ * @return  Pointer to next buffer node (NULL if none)
+*/
+buffer_node_t* buffer_next(buffer_t *buffer, buffer_node_t *node) {
+    uint32_t seqno = ntohl(node->packet.seqno);
+    while (seqno != buffer->last) {
+        seqno++;
+        if (buffer->slots[seqno & buffer->mask] != NULL) {
+            return buffer->slots[seqno & buffer->mask];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get the buffer node holding the packet with the given sequence number.
+ *
+ * @param   buffer      Pointer to buffer
+ * @param   seqno       Sequence number to look up
+ *
+ * @return  Pointer to buffer node (NULL if none)
+*/
+buffer_node_t* buffer_get(buffer_t *buffer, uint32_t seqno) {
+    if (buffer->size == 0 || seq_lt(seqno, buffer->first) || seq_gt(seqno, buffer->last)) {
+        return NULL;
+    }
+    return buffer->slots[seqno & buffer->mask];
 }
 
 /**
@@ -19,75 +77,69 @@ buffer_node_t* buffer_get_first(buffer_t *buffer) {
  * @return  0 iff first node removed, else non-zero
 */
 int buffer_remove_first(buffer_t *buffer) {
-    if (buffer->head == NULL) {
+    if (buffer->size == 0) {
         return 1;
     } else {
-        buffer_node_t* to_remove = buffer->head;
-        buffer->head = buffer->head->next;
-        free(to_remove);
+        buffer_node_t** slot = &buffer->slots[buffer->first & buffer->mask];
+        tw_timer_del(&(*slot)->timer);
+        pool_put(buffer->pool, *slot);
+        *slot = NULL;
+        buffer->size--;
+
+        // Move the head on to the next occupied slot (the window may have holes)
+        if (buffer->size > 0) {
+            do {
+                buffer->first++;
+            } while (buffer->slots[buffer->first & buffer->mask] == NULL);
+        }
         return 0;
     }
 }
 
 /**
  * Inserting a packet in its place by its sequence number.
+ * The packet is copied into a node taken from the pool, only as far as its length field says.
+ * A packet already buffered under the same sequence number is replaced.
+ * The retransmission count of the node starts at 0, it is neither sacked nor delivered, and its timer is not pending.
  *
  * @param   buffer              Pointer to buffer
  * @param   packet              Pointer to packet
  * @param   last_retransmit     Last retransmission time (long)
+ *
+ * @return  0 iff inserted, else non-zero (sequence number outside of the buffer capacity)
 */
-void buffer_insert(buffer_t *buffer, packet_t *packet, long last_retransmit) {
+int buffer_insert(buffer_t *buffer, packet_t *packet, long last_retransmit) {
+    uint32_t seqno = ntohl(packet->seqno);
+    uint32_t first = seqno;
+    uint32_t last = seqno;
+
+    // The new node has to fit in the ring together with everything already in there
+    if (buffer->size > 0) {
+        first = seq_lt(buffer->first, seqno) ? buffer->first : seqno;
+        last = seq_gt(buffer->last, seqno) ? buffer->last : seqno;
+        if (last - first > buffer->mask) {
+            return 1;
+        }
+    }
 
     // Node to insert
-    buffer_node_t* to_insert = xmalloc(sizeof(buffer_node_t));
-    to_insert->packet = *packet;
-    to_insert->last_retransmit = last_retransmit;
-
-    // When iterating, previous and current
-    buffer_node_t* prev = NULL;
-    buffer_node_t* current = buffer_get_first(buffer);
-
-    // If the buffer is empty, add as head
-    if (current == NULL) {
-        buffer->head = to_insert;
-        to_insert->next = NULL;
+    buffer_node_t** slot = &buffer->slots[seqno & buffer->mask];
+    if (*slot == NULL) {
+        *slot = pool_get(buffer->pool);
+        buffer->size++;
     } else {
-
-        // If the buffer is not empty, go until a packet with a higher sequence
-        // number is found
-        while (current != NULL) {
-
-            // If found an element whose sequence number is higher
-            if (ntohl(current->packet.seqno) > ntohl(packet->seqno)) {
-
-                // If it was the head (there is no previous)
-                if (prev == NULL) {
-                    buffer->head = to_insert;
-                    to_insert->next = current;
-
-                // If it was somewhere in between
-                } else {
-                    prev->next = to_insert;
-                    to_insert->next = current;
-                }
-
-                break;
-
-            // If at the tail, then add there, and finish
-            } else if (current->next == NULL) {
-                current->next = to_insert;
-                to_insert->next = NULL;
-                break;
-            }
-
-            // Move on
-            prev = current;
-            current = current->next;
-
-        }
-
+        tw_timer_del(&(*slot)->timer);
     }
-
+    memcpy(&(*slot)->packet, packet, ntohs(packet->len));
+    (*slot)->last_retransmit = last_retransmit;
+    (*slot)->retransmits = 0;
+    (*slot)->sacked = 0;
+    (*slot)->delivered = 0;
+    tw_timer_init(&(*slot)->timer, NULL, NULL);
+
+    buffer->first = first;
+    buffer->last = last;
+    return 0;
 }
 
 /**
@@ -99,16 +151,10 @@ void buffer_insert(buffer_t *buffer, packet_t *packet, long last_retransmit) {
  * @return  Number of buffer nodes removed
 */
 uint32_t buffer_remove(buffer_t *buffer, uint32_t seqno_until_excl) {
-    buffer_node_t* first = buffer_get_first(buffer);
     uint32_t num_removed = 0;
-    while (first != NULL) {
-        if (ntohl(first->packet.seqno) >= seqno_until_excl) {
-            break;
-        } else {
-            buffer_remove_first(buffer);
-            first = buffer_get_first(buffer);
-            num_removed++;
-        }
+    while (buffer->size > 0 && seq_lt(buffer->first, seqno_until_excl)) {
+        buffer_remove_first(buffer);
+        num_removed++;
     }
     return num_removed;
 }
@@ -127,8 +173,8 @@ void buffer_print(buffer_t *buffer) {
         } else {
             first = 0;
         }
-        fprintf(stderr, "%d (l=%d)" , ntohl(current->packet.seqno), ntohs(current->packet.len));
-        current = current->next;
+        fprintf(stderr, "%u (l=%d)" , ntohl(current->packet.seqno), ntohs(current->packet.len));
+        current = buffer_next(buffer, current);
     }
     fprintf(stderr, "\n");
 }
@@ -141,13 +187,7 @@ void buffer_print(buffer_t *buffer) {
  * @return  Buffer size
 */
 uint32_t buffer_size(buffer_t *buffer) {
-    uint32_t i = 0;
-    buffer_node_t* current = buffer_get_first(buffer);
-    while (current != NULL) {
-        i++;
-        current = current->next;
-    }
-    return i;
+    return buffer->size;
 }
 
 /**
@@ -161,6 +201,18 @@ void buffer_clear(buffer_t *buffer) {
     }
 }
 
+/**
+ * Clear out the entire buffer and release its ring of slots.
+ * The buffer must be initialized again before it can be reused.
+ *
+ * @param   buffer      Pointer to buffer
+*/
+void buffer_destroy(buffer_t *buffer) {
+    buffer_clear(buffer);
+    free(buffer->slots);
+    buffer->slots = NULL;
+}
+
 /**
  * Check whether the buffer contains a packet with the given sequence number.
  *
@@ -170,14 +222,5 @@ void buffer_clear(buffer_t *buffer) {
  * @return  1 iff the buffer contains the packet, 0 otherwise
 */
 int buffer_contains(buffer_t *buffer, uint32_t seqno) {
-    int in_there = 0;
-    buffer_node_t* current = buffer_get_first(buffer);
-    while (current != NULL) {
-        if (ntohl(current->packet.seqno) == seqno) {
-            in_there = 1;
-            break;
-        }
-        current = current->next;
-    }
-    return in_there;
+    return buffer_get(buffer, seqno) != NULL;
 }
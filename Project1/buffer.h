@@ -16,30 +16,66 @@
 #include <netinet/in.h>
 
 #include "rlib.h"
+#include "pool.h"
+#include "seq.h"
+#include "timer_wheel.h"
 
 /*
  * A buffer is a priority queue of buffer nodes.
  * It is ordered by the packet sequence number (seqno).
  *
- * Each buffer node has three properties: (a) a full copy of the packet (incl. its sequence number),
- * (b) the last time it was transmitted, and (c) the next packet in the list (NULL if none).
+ * Internally the buffer is a fixed-capacity ring of node pointers indexed by (seqno % capacity), where the
+ * capacity is rounded up to a power of two. All sequence numbers held at the same time must therefore lie within
+ * one capacity of each other, which holds for both the send and the receive window as long as the buffer is
+ * created with at least the window size. Sequence numbers are compared as serial numbers (see seq.h), so the ring
+ * keeps working when they wrap around. Insert, lookup and removal of the first node run in O(1).
  *
- * The content of the buffer (its nodes) are allocated on the heap, including the full packet copies.
- * After serving its purpose, its content must be freed explicitly (via buffer_clear(buffer)) for proper clean-up.
- * Free-ing merely the buffer pointer DOES NOT suffice (but it should be done of course after clearing the buffer
- * content).
+ * Each buffer node has six properties: (a) a full copy of the packet (incl. its sequence number), (b) the last time
+ * it was transmitted, (c) how often it has been retransmitted since, (d) its retransmission timer, (e) whether the
+ * receiver has selectively acknowledged it and (f) whether the receiver has already written out its payload ahead of
+ * packets still missing before it. The timer is initialized (not pending) on insert and cancelled when the node leaves
+ * the buffer.
+ * Nodes are visited in order with buffer_get_first() and buffer_next().
+ *
+ * The content of the buffer (its nodes) are taken from a pool, including the full packet copies, so that inserting
+ * and removing packets does not touch the heap once the pool is large enough. The pool blocks need only be
+ * BUFFER_NODE_SIZE(payload) bytes for packets of up to payload bytes. The pool may be shared between
+ * buffers (e.g. the send and receive buffer of one connection) and must outlive them.
+ * After serving its purpose, its content must be returned explicitly (via buffer_destroy(buffer)) for proper
+ * clean-up. Free-ing merely the buffer pointer DOES NOT suffice (but it should be done of course after destroying
+ * the buffer content).
 */
 
 typedef struct buffer_node {
-    packet_t packet;
     long last_retransmit;
-    struct buffer_node* next;
+    int retransmits;
+    tw_timer_t timer;
+    int sacked;                 /* Reported received by a SACK, no longer retransmitted */
+    int delivered;              /* Payload written out, kept until the packets before it arrive (--streams) */
+    packet_t packet;            /* Last, so that a node may end after the largest payload it holds */
 } buffer_node_t;
 
+/* Size of a node whose packet holds at most the given payload (a pool block size) */
+#define BUFFER_NODE_SIZE(payload) (offsetof(buffer_node_t, packet.data) + (payload))
+
 typedef struct buffer {
-    buffer_node_t* head;
+    buffer_node_t** slots;      /* Ring of capacity slots, NULL if empty */
+    uint32_t mask;              /* capacity - 1 */
+    uint32_t first;             /* Lowest sequence number held (valid iff size > 0) */
+    uint32_t last;              /* Highest sequence number held (valid iff size > 0) */
+    uint32_t size;              /* Number of nodes held */
+    pool_t* pool;               /* Pool the nodes are taken from */
 } buffer_t;
 
+/**
+ * Initialize an empty buffer able to hold sequence numbers spanning at least the given capacity.
+ *
+ * @param   buffer      Pointer to buffer
+ * @param   capacity    Minimum capacity (rounded up to a power of two)
+ * @param   pool        Pool of sizeof(buffer_node_t) blocks to take the nodes from
+*/
+void buffer_init(buffer_t *buffer, uint32_t capacity, pool_t *pool);
+
 /**
  * Get the first buffer node (lowest sequence number).
  *
@@ -49,6 +85,26 @@ typedef struct buffer {
 */
 buffer_node_t* buffer_get_first(buffer_t *buffer);
 
+/**
+ * Get the buffer node following the given one (next higher sequence number).
+ *
+ * @param   buffer      Pointer to buffer
+ * @param   node        Pointer to a buffer node in the buffer
+ *
+ * @return  Pointer to next buffer node (NULL if none)
+*/
+buffer_node_t* buffer_next(buffer_t *buffer, buffer_node_t *node);
+
+/**
+ * Get the buffer node holding the packet with the given sequence number.
+ *
+ * @param   buffer      Pointer to buffer
+ * @param   seqno       Sequence number to look up
+ *
+ * @return  Pointer to buffer node (NULL if none)
+*/
+buffer_node_t* buffer_get(buffer_t *buffer, uint32_t seqno);
+
 /**
  * Remove the first buffer node (lowest sequence number).
  *
@@ -60,13 +116,17 @@ int buffer_remove_first(buffer_t *buffer);
 
 /**
  * Inserting a packet in its place by its sequence number.
- * The packet itself is completely copied onto the heap.
+ * The packet is copied into a node taken from the pool, only as far as its length field says.
+ * A packet already buffered under the same sequence number is replaced.
+ * The retransmission count of the node starts at 0, it is not sacked, and its timer is not pending.
  *
  * @param   buffer              Pointer to buffer
  * @param   packet              Pointer to packet
  * @param   last_retransmit     Last retransmission time (long)
+ *
+ * @return  0 iff inserted, else non-zero (sequence number outside of the buffer capacity)
 */
-void buffer_insert(buffer_t *buffer, packet_t *packet, long last_retransmit);
+int buffer_insert(buffer_t *buffer, packet_t *packet, long last_retransmit);
 
 /**
  * Remove all buffer nodes until (lower-than exclusive <) a certain packet sequence number from the buffer.
@@ -101,6 +161,14 @@ uint32_t buffer_size(buffer_t *buffer);
 */
 void buffer_clear(buffer_t *buffer);
 
+/**
+ * Clear out the entire buffer and release its ring of slots.
+ * The buffer must be initialized again before it can be reused.
+ *
+ * @param   buffer      Pointer to buffer
+*/
+void buffer_destroy(buffer_t *buffer);
+
 /**
  * Check whether the buffer contains a packet with the given sequence number.
  *
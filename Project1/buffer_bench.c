@@ -0,0 +1,246 @@
+/*
+ * Microbenchmark of the seqno-indexed ring buffer (buffer.c) against the sorted linked list it replaced.
+ *
+ * Two access patterns are measured for each window size:
+ *
+ *   sender:    the window is kept full; every step acknowledges the first packet (remove first) and sends a new one
+ *              (insert at the tail), then looks up one in-flight packet.
+ *   receiver:  each window arrives in reverse order (every insert is out of order), then is delivered in order.
+ *
+ * The ring takes its nodes from a pool sized for one window, the list mallocs every node. The last column shows the
+ * number of heap allocations the ring's pool made over a whole run, which must stay at 1 regardless of the steps.
+ *
+ * Usage: ./buffer_bench [steps]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "buffer.h"
+
+char *progname = "buffer_bench";
+
+void *
+xmalloc (size_t n)
+{
+    void *p = malloc (n);
+    if (!p) {
+        fprintf (stderr, "%s: out of memory allocating %d bytes\n",
+        progname, (int) n);
+        abort ();
+    }
+    return p;
+}
+
+/* ------------------------- Previous sorted linked list ------------------------- */
+
+typedef struct list_node {
+    packet_t packet;
+    long last_retransmit;
+    struct list_node* next;
+} list_node_t;
+
+typedef struct list {
+    list_node_t* head;
+} list_t;
+
+static int list_remove_first(list_t *list) {
+    if (list->head == NULL) {
+        return 1;
+    }
+    list_node_t* to_remove = list->head;
+    list->head = list->head->next;
+    free(to_remove);
+    return 0;
+}
+
+static void list_insert(list_t *list, packet_t *packet, long last_retransmit) {
+    list_node_t* to_insert = xmalloc(sizeof(list_node_t));
+    memcpy(&to_insert->packet, packet, ntohs(packet->len));
+    to_insert->last_retransmit = last_retransmit;
+
+    list_node_t* prev = NULL;
+    list_node_t* current = list->head;
+    if (current == NULL) {
+        list->head = to_insert;
+        to_insert->next = NULL;
+        return;
+    }
+    while (current != NULL) {
+        if (ntohl(current->packet.seqno) > ntohl(packet->seqno)) {
+            if (prev == NULL) {
+                list->head = to_insert;
+            } else {
+                prev->next = to_insert;
+            }
+            to_insert->next = current;
+            return;
+        } else if (current->next == NULL) {
+            current->next = to_insert;
+            to_insert->next = NULL;
+            return;
+        }
+        prev = current;
+        current = current->next;
+    }
+}
+
+static int list_contains(list_t *list, uint32_t seqno) {
+    list_node_t* current;
+    for (current = list->head; current != NULL; current = current->next) {
+        if (ntohl(current->packet.seqno) == seqno) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void list_clear(list_t *list) {
+    while (list->head != NULL) {
+        list_remove_first(list);
+    }
+}
+
+/* ------------------------------------------------------------------------------- */
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static packet_t make_packet(uint32_t seqno) {
+    packet_t packet;
+    memset(&packet, 0, offsetof(packet_t, data) + PACKET_DATA_DEFAULT);
+    packet.len = htons(512);
+    packet.seqno = htonl(seqno);
+    return packet;
+}
+
+static volatile int sink;
+static unsigned long ring_heap_allocs;
+
+static double bench_ring_sender(uint32_t window, long steps) {
+    buffer_t buffer;
+    pool_t pool;
+    uint32_t seqno;
+    long i;
+    pool_init(&pool, BUFFER_NODE_SIZE(PACKET_DATA_DEFAULT), window);
+    buffer_init(&buffer, window, &pool);
+    for (seqno = 1; seqno <= window; seqno++) {
+        packet_t packet = make_packet(seqno);
+        buffer_insert(&buffer, &packet, 0);
+    }
+    double start = now_ns();
+    for (i = 0; i < steps; i++, seqno++) {
+        packet_t packet = make_packet(seqno);
+        buffer_remove_first(&buffer);
+        buffer_insert(&buffer, &packet, 0);
+        sink += buffer_contains(&buffer, seqno - (i % window));
+    }
+    double elapsed = now_ns() - start;
+    buffer_destroy(&buffer);
+    if (pool.heap_allocs > ring_heap_allocs) {
+        ring_heap_allocs = pool.heap_allocs;
+    }
+    pool_destroy(&pool);
+    return elapsed / steps;
+}
+
+static double bench_list_sender(uint32_t window, long steps) {
+    list_t list = { NULL };
+    uint32_t seqno;
+    long i;
+    for (seqno = 1; seqno <= window; seqno++) {
+        packet_t packet = make_packet(seqno);
+        list_insert(&list, &packet, 0);
+    }
+    double start = now_ns();
+    for (i = 0; i < steps; i++, seqno++) {
+        packet_t packet = make_packet(seqno);
+        list_remove_first(&list);
+        list_insert(&list, &packet, 0);
+        sink += list_contains(&list, seqno - (i % window));
+    }
+    double elapsed = now_ns() - start;
+    list_clear(&list);
+    return elapsed / steps;
+}
+
+static double bench_ring_receiver(uint32_t window, long steps) {
+    buffer_t buffer;
+    pool_t pool;
+    uint32_t base = 1;
+    long done = 0;
+    pool_init(&pool, BUFFER_NODE_SIZE(PACKET_DATA_DEFAULT), window);
+    buffer_init(&buffer, window, &pool);
+    double start = now_ns();
+    while (done < steps) {
+        uint32_t k;
+        for (k = window; k > 0; k--) {
+            packet_t packet = make_packet(base + k - 1);
+            if (!buffer_contains(&buffer, base + k - 1)) {
+                buffer_insert(&buffer, &packet, 0);
+            }
+        }
+        while (buffer_get_first(&buffer) != NULL) {
+            buffer_remove_first(&buffer);
+        }
+        base += window;
+        done += window;
+    }
+    double elapsed = now_ns() - start;
+    buffer_destroy(&buffer);
+    if (pool.heap_allocs > ring_heap_allocs) {
+        ring_heap_allocs = pool.heap_allocs;
+    }
+    pool_destroy(&pool);
+    return elapsed / done;
+}
+
+static double bench_list_receiver(uint32_t window, long steps) {
+    list_t list = { NULL };
+    uint32_t base = 1;
+    long done = 0;
+    double start = now_ns();
+    while (done < steps) {
+        uint32_t k;
+        for (k = window; k > 0; k--) {
+            packet_t packet = make_packet(base + k - 1);
+            if (!list_contains(&list, base + k - 1)) {
+                list_insert(&list, &packet, 0);
+            }
+        }
+        list_clear(&list);
+        base += window;
+        done += window;
+    }
+    double elapsed = now_ns() - start;
+    return elapsed / done;
+}
+
+int main(int argc, char **argv) {
+    static const uint32_t windows[] = { 1, 64, 1024, 16384 };
+    long steps = argc > 1 ? atol(argv[1]) : 200000;
+    size_t i;
+
+    printf("%8s  %14s %14s %9s  %14s %14s %9s  %11s\n", "window",
+           "sender ring", "sender list", "speedup",
+           "receiver ring", "receiver list", "speedup", "ring allocs");
+    for (i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+        uint32_t w = windows[i];
+        /* The list is O(window) per operation, keep its total work bounded */
+        long list_steps = steps / (w / 64 + 1) + w;
+        ring_heap_allocs = 0;
+        double rs = bench_ring_sender(w, steps);
+        double ls = bench_list_sender(w, list_steps);
+        double rr = bench_ring_receiver(w, steps);
+        double lr = bench_list_receiver(w, list_steps);
+        printf("%8u  %11.1f ns %11.1f ns %8.1fx  %11.1f ns %11.1f ns %8.1fx  %11lu\n", w,
+               rs, ls, ls / rs, rr, lr, lr / rr, ring_heap_allocs);
+    }
+    return 0;
+}
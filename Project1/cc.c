@@ -0,0 +1,313 @@
+#include <math.h>
+#include <string.h>
+
+#include "cc.h"
+#include "seq.h"
+
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+#define BBR_CWND_GAIN 2.0           /* Window in bandwidth-delay products */
+#define BBR_FULL_BW_GROWTH 1.25     /* Startup ends once the bandwidth grew less than this... */
+#define BBR_FULL_BW_ROUNDS 3        /* ...for this many rounds */
+
+/* ------------------------------------ none ------------------------------------ */
+
+static void none_init(cc_t *cc) {
+    cc->cwnd = cc->max_window;
+}
+
+static void none_on_ack(cc_t *cc, uint32_t acked, long rtt, long now) {
+}
+
+static void none_on_event(cc_t *cc, long now) {
+}
+
+/* ------------------------------------ reno ------------------------------------ */
+
+static void reno_init(cc_t *cc) {
+    cc->cwnd = CC_INITIAL_WINDOW;
+    cc->ssthresh = cc->max_window;
+}
+
+static void reno_on_ack(cc_t *cc, uint32_t acked, long rtt, long now) {
+    if (cc->in_recovery) {
+        return;
+    }
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += acked;
+    } else {
+        cc->cwnd += acked / cc->cwnd;
+    }
+}
+
+static void reno_on_loss(cc_t *cc, long now) {
+    cc->ssthresh = fmax(cc->cwnd / 2, CC_MIN_WINDOW);
+    cc->cwnd = cc->ssthresh;
+}
+
+static void reno_on_timeout(cc_t *cc, long now) {
+    cc->ssthresh = fmax(cc->cwnd / 2, CC_MIN_WINDOW);
+    cc->cwnd = 1;
+}
+
+/* ------------------------------------ cubic ------------------------------------ */
+
+static void cubic_init(cc_t *cc) {
+    reno_init(cc);
+    cc->w_max = 0;
+    cc->epoch_start = -1;
+}
+
+static void cubic_on_ack(cc_t *cc, uint32_t acked, long rtt, long now) {
+    double t, target;
+
+    if (cc->in_recovery) {
+        return;
+    }
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += acked;
+        return;
+    }
+    // A congestion avoidance epoch starts with the first acknowledgement after a reduction (or slow start)
+    if (cc->epoch_start < 0) {
+        cc->epoch_start = now;
+        if (cc->cwnd < cc->w_max) {
+            cc->k = cbrt((cc->w_max - cc->cwnd) / CUBIC_C);
+        } else {
+            cc->k = 0;
+            cc->w_max = cc->cwnd;
+        }
+        cc->w_est = cc->cwnd;
+    }
+
+    // Aim for where the cubic function will be one round trip from now
+    t = (now - cc->epoch_start + (cc->last_rtt > 0 ? cc->last_rtt : 0)) / 1000.0;
+    target = CUBIC_C * (t - cc->k) * (t - cc->k) * (t - cc->k) + cc->w_max;
+    if (target > cc->cwnd) {
+        cc->cwnd += acked * (target - cc->cwnd) / cc->cwnd;
+    } else {
+        cc->cwnd += acked * 0.01 / cc->cwnd;
+    }
+
+    // TCP-friendly region: never slower than reno with the same reduction
+    cc->w_est += acked * 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) / cc->cwnd;
+    if (cc->w_est > cc->cwnd) {
+        cc->cwnd = cc->w_est;
+    }
+}
+
+/**
+ * Remember the window at which a loss happened, releasing bandwidth early (fast convergence) if it is lower than at
+ * the previous loss.
+ *
+ * @param   cc      Pointer to state
+*/
+static void cubic_reduce(cc_t *cc) {
+    if (cc->cwnd < cc->w_max) {
+        cc->w_max = cc->cwnd * (1 + CUBIC_BETA) / 2;
+    } else {
+        cc->w_max = cc->cwnd;
+    }
+    cc->ssthresh = fmax(cc->cwnd * CUBIC_BETA, CC_MIN_WINDOW);
+    cc->epoch_start = -1;
+}
+
+static void cubic_on_loss(cc_t *cc, long now) {
+    cubic_reduce(cc);
+    cc->cwnd = cc->ssthresh;
+}
+
+static void cubic_on_timeout(cc_t *cc, long now) {
+    cubic_reduce(cc);
+    cc->cwnd = 1;
+}
+
+/* ------------------------------------ bbr ------------------------------------ */
+
+static void bbr_init(cc_t *cc) {
+    cc->cwnd = CC_INITIAL_WINDOW;
+    cc->startup = 1;
+    cc->round_start = -1;
+    cc->min_rtt = -1;
+}
+
+/**
+ * Retrieve the bottleneck bandwidth, the highest delivery rate of the last rounds.
+ *
+ * @param   cc      Pointer to state
+ *
+ * @return  Bandwidth in packets per millisecond
+*/
+static double bbr_bw(cc_t *cc) {
+    double bw = 0;
+    int i;
+    for (i = 0; i < BBR_BW_ROUNDS; i++) {
+        bw = fmax(bw, cc->btl_bw[i]);
+    }
+    return bw;
+}
+
+static void bbr_on_ack(cc_t *cc, uint32_t acked, long rtt, long now) {
+    long round_len;
+
+    if (rtt >= 0 && (cc->min_rtt < 0 || rtt <= cc->min_rtt || now - cc->min_rtt_stamp > BBR_MIN_RTT_WINDOW)) {
+        cc->min_rtt = rtt;
+        cc->min_rtt_stamp = now;
+    }
+    if (cc->round_start < 0) {
+        cc->round_start = now;
+        cc->round_delivered = 0;
+    }
+    cc->round_delivered += acked;
+
+    // A round lasts one (minimum) round trip; at its end, take a delivery rate sample
+    round_len = cc->min_rtt > 1 ? cc->min_rtt : 1;
+    if (now - cc->round_start >= round_len) {
+        cc->btl_bw[cc->bw_round++ % BBR_BW_ROUNDS] = (double)cc->round_delivered / (now - cc->round_start);
+        cc->round_start = now;
+        cc->round_delivered = 0;
+
+        if (cc->startup) {
+            if (bbr_bw(cc) >= cc->full_bw * BBR_FULL_BW_GROWTH) {
+                cc->full_bw = bbr_bw(cc);
+                cc->full_bw_rounds = 0;
+            } else if (++cc->full_bw_rounds >= BBR_FULL_BW_ROUNDS) {
+                cc->startup = 0;
+            }
+        }
+    }
+
+    if (cc->startup) {
+        cc->cwnd += acked;
+    } else {
+        cc->cwnd = fmax(BBR_CWND_GAIN * bbr_bw(cc) * round_len, CC_INITIAL_WINDOW);
+    }
+}
+
+static void bbr_on_timeout(cc_t *cc, long now) {
+    cc->cwnd = CC_INITIAL_WINDOW;
+}
+
+/* ------------------------------------------------------------------------------- */
+
+static const cc_ops_t cc_algorithms[] = {
+    { "none", none_init, none_on_ack, none_on_event, none_on_event },
+    { "reno", reno_init, reno_on_ack, reno_on_loss, reno_on_timeout },
+    { "cubic", cubic_init, cubic_on_ack, cubic_on_loss, cubic_on_timeout },
+    { "bbr", bbr_init, bbr_on_ack, none_on_event, bbr_on_timeout },
+};
+
+/**
+ * Keep the window within [1, max_window].
+ *
+ * @param   cc      Pointer to state
+*/
+static void cc_clamp(cc_t *cc) {
+    if (cc->cwnd > cc->max_window) {
+        cc->cwnd = cc->max_window;
+    } else if (cc->cwnd < 1) {
+        cc->cwnd = 1;
+    }
+}
+
+/**
+ * Look up a congestion control algorithm by name.
+ *
+ * @param   name    Name of the algorithm (none, reno, cubic, bbr)
+ *
+ * @return  Pointer to the algorithm (NULL if unknown)
+*/
+const cc_ops_t* cc_find(const char *name) {
+    size_t i;
+    for (i = 0; i < sizeof(cc_algorithms) / sizeof(cc_algorithms[0]); i++) {
+        if (strcmp(cc_algorithms[i].name, name) == 0) {
+            return &cc_algorithms[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Initialize the congestion control of a connection.
+ *
+ * @param   cc          Pointer to state
+ * @param   ops         Algorithm
+ * @param   max_window  Configured window (packets)
+*/
+void cc_init(cc_t *cc, const cc_ops_t *ops, uint32_t max_window) {
+    memset(cc, 0, sizeof(*cc));
+    cc->ops = ops;
+    cc->max_window = max_window;
+    cc->ssthresh = max_window;
+    cc->last_rtt = -1;
+    ops->init(cc);
+    cc_clamp(cc);
+}
+
+/**
+ * Retrieve the number of packets that may be in flight.
+ *
+ * @param   cc          Pointer to state
+ *
+ * @return  Congestion window in packets (at least 1)
+*/
+uint32_t cc_window(cc_t *cc) {
+    return (uint32_t)cc->cwnd;
+}
+
+/**
+ * Report an acknowledgement of new data.
+ *
+ * @param   cc          Pointer to state
+ * @param   acked       Number of packets newly acknowledged
+ * @param   ackno       Cumulative ackno
+ * @param   rtt         RTT sample taken from the acknowledgement (ms), -1 if none
+ * @param   now         Current time (ms)
+*/
+void cc_on_ack(cc_t *cc, uint32_t acked, uint32_t ackno, long rtt, long now) {
+    if (rtt >= 0) {
+        cc->last_rtt = rtt;
+    }
+    if (cc->in_recovery && seq_geq(ackno, cc->recover)) {
+        cc->in_recovery = 0;
+    }
+    // Keep the recovery point within reach of serial comparisons
+    if (seq_gt(ackno, cc->recover)) {
+        cc->recover = ackno;
+    }
+    cc->ops->on_ack(cc, acked, rtt, now);
+    cc_clamp(cc);
+}
+
+/**
+ * Report a loss detected by duplicate acknowledgements.
+ *
+ * @param   cc          Pointer to state
+ * @param   snd_una     Oldest unacknowledged seqno
+ * @param   snd_nxt     Next seqno to be sent
+ * @param   now         Current time (ms)
+*/
+void cc_on_loss(cc_t *cc, uint32_t snd_una, uint32_t snd_nxt, long now) {
+    if (seq_lt(snd_una, cc->recover)) {
+        return;
+    }
+    cc->in_recovery = 1;
+    cc->recover = snd_nxt;
+    cc->ops->on_loss(cc, now);
+    cc_clamp(cc);
+}
+
+/**
+ * Report a retransmission timeout of the oldest packet in flight.
+ *
+ * @param   cc          Pointer to state
+ * @param   snd_nxt     Next seqno to be sent
+ * @param   now         Current time (ms)
+*/
+void cc_on_timeout(cc_t *cc, uint32_t snd_nxt, long now) {
+    cc->in_recovery = 0;
+    cc->recover = snd_nxt;
+    cc->ops->on_timeout(cc, now);
+    cc_clamp(cc);
+}
@@ -0,0 +1,130 @@
+#ifndef CC_H
+#define CC_H
+
+#include <stdint.h>
+
+/*
+ * Congestion control: a congestion window (cwnd), in packets, that limits the packets in flight on top of the
+ * configured window (-w). The connection reports acknowledgements, losses detected by duplicate acknowledgements
+ * and retransmission timeouts; the algorithm behind it is chosen per connection (the --cc option):
+ *
+ *   none   The congestion window is the configured window, nothing is ever reduced.
+ *
+ *   reno   Slow start doubles the window every round trip up to ssthresh, then congestion avoidance adds one
+ *          packet per round trip. A loss halves the window, a timeout restarts slow start from one packet.
+ *
+ *   cubic  Like reno, but after a loss the window follows the cubic function of RFC 8312 (C = 0.4, beta = 0.7):
+ *          it quickly returns to the window at which the loss happened, plateaus around it and then probes beyond.
+ *          It never grows slower than reno would.
+ *
+ *   bbr    A simplified BBR: the window is sized from a model of the path instead of from losses. The delivery rate
+ *          is measured every round trip and the bottleneck bandwidth is the maximum of the last BBR_BW_ROUNDS
+ *          rounds; the window is twice the bandwidth-delay product (with the minimum RTT seen in the last
+ *          BBR_MIN_RTT_WINDOW ms). It starts by doubling the window every round until the bandwidth stops growing.
+ *          Losses are ignored, timeouts restart from the initial window.
+ *
+ * A loss only reduces the window once per window of data: losses of packets sent before the reduction belong to
+ * the same congestion event and are ignored until everything sent up to the reduction is acknowledged.
+*/
+
+#define CC_INITIAL_WINDOW 4         /* Initial congestion window (packets) */
+#define CC_MIN_WINDOW 2             /* Lower bound after a loss (packets) */
+
+#define BBR_BW_ROUNDS 10            /* Rounds the bottleneck bandwidth is remembered for */
+#define BBR_MIN_RTT_WINDOW 10000    /* Time the minimum RTT is remembered for (ms) */
+
+typedef struct cc cc_t;
+
+typedef struct cc_ops {
+    const char* name;
+    void (*init)(cc_t *cc);
+    void (*on_ack)(cc_t *cc, uint32_t acked, long rtt, long now);     /* rtt is -1 without a sample */
+    void (*on_loss)(cc_t *cc, long now);
+    void (*on_timeout)(cc_t *cc, long now);
+} cc_ops_t;
+
+struct cc {
+    const cc_ops_t* ops;        /* Algorithm */
+    double cwnd;                /* Congestion window (packets) */
+    double ssthresh;            /* Slow start threshold (packets) */
+    double max_window;          /* Upper bound of cwnd, the configured window */
+    uint32_t recover;           /* Losses of packets before this seqno belong to the last congestion event */
+    int in_recovery;            /* Non-zero while recovering from a loss, the window does not grow meanwhile */
+    long last_rtt;              /* Latest RTT sample (ms), -1 if none yet */
+
+    /* cubic */
+    double w_max;               /* Window before the last reduction */
+    double k;                   /* Time to reach w_max again after a reduction (s) */
+    long epoch_start;           /* Start of the current congestion avoidance epoch (ms), -1 if none */
+    double w_est;               /* Window reno would have reached in the same epoch */
+
+    /* bbr */
+    int startup;                /* Non-zero until the bandwidth stopped growing */
+    double btl_bw[BBR_BW_ROUNDS];   /* Delivery rate of the last rounds (packets/ms) */
+    int bw_round;               /* Round counter, indexes btl_bw */
+    long round_start;           /* Start of the current round (ms) */
+    uint32_t round_delivered;   /* Packets acknowledged in the current round */
+    double full_bw;             /* Bandwidth at the last significant increase during startup */
+    int full_bw_rounds;         /* Rounds since then */
+    long min_rtt;               /* Minimum RTT (ms), -1 if none yet */
+    long min_rtt_stamp;         /* When it was measured */
+};
+
+/**
+ * Look up a congestion control algorithm by name.
+ *
+ * @param   name    Name of the algorithm (none, reno, cubic, bbr)
+ *
+ * @return  Pointer to the algorithm (NULL if unknown)
+*/
+const cc_ops_t* cc_find(const char *name);
+
+/**
+ * Initialize the congestion control of a connection.
+ *
+ * @param   cc          Pointer to state
+ * @param   ops         Algorithm
+ * @param   max_window  Configured window (packets)
+*/
+void cc_init(cc_t *cc, const cc_ops_t *ops, uint32_t max_window);
+
+/**
+ * Retrieve the number of packets that may be in flight.
+ *
+ * @param   cc          Pointer to state
+ *
+ * @return  Congestion window in packets (at least 1)
+*/
+uint32_t cc_window(cc_t *cc);
+
+/**
+ * Report an acknowledgement of new data.
+ *
+ * @param   cc          Pointer to state
+ * @param   acked       Number of packets newly acknowledged
+ * @param   ackno       Cumulative ackno
+ * @param   rtt         RTT sample taken from the acknowledgement (ms), -1 if none
+ * @param   now         Current time (ms)
+*/
+void cc_on_ack(cc_t *cc, uint32_t acked, uint32_t ackno, long rtt, long now);
+
+/**
+ * Report a loss detected by duplicate acknowledgements.
+ *
+ * @param   cc          Pointer to state
+ * @param   snd_una     Oldest unacknowledged seqno
+ * @param   snd_nxt     Next seqno to be sent
+ * @param   now         Current time (ms)
+*/
+void cc_on_loss(cc_t *cc, uint32_t snd_una, uint32_t snd_nxt, long now);
+
+/**
+ * Report a retransmission timeout of the oldest packet in flight.
+ *
+ * @param   cc          Pointer to state
+ * @param   snd_nxt     Next seqno to be sent
+ * @param   now         Current time (ms)
+*/
+void cc_on_timeout(cc_t *cc, uint32_t snd_nxt, long now);
+
+#endif /* CC_H */
@@ -0,0 +1,193 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "cksum.h"
+
+#if CKSUM_X86
+#include <immintrin.h>
+#endif
+
+/* 32-bit lanes take at most this many 16-bit words before they have to be folded */
+#define LANE_WORDS 65536
+
+/**
+ * Fold a native byte order sum into the checksum: 16 bits, complemented, never 0.
+ *
+ * @param   sum     Sum of the buffer in native byte order, 16-bit words added up without folding
+ *
+ * @return  Checksum in network byte order
+*/
+static uint16_t cksum_finish(uint64_t sum) {
+    uint16_t r;
+
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    r = ~sum;
+    return r ? r : 0xffff;
+}
+
+/**
+ * Add a buffer to a native byte order sum, 64 bits at a time.
+ *
+ * @param   sum     Sum so far
+ * @param   p       Pointer to the bytes
+ * @param   len     Number of bytes
+ *
+ * @return  New sum
+*/
+static uint64_t words_sum(uint64_t sum, const uint8_t *p, int len) {
+    uint64_t w;
+    uint32_t w32;
+    uint16_t w16 = 0;
+
+    // The halves are at most 2^32 - 1, so 2^32 of them fit into the sum without overflowing
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&w, p, 8);
+        sum += (uint32_t)w;
+        sum += w >> 32;
+    }
+    if (len >= 4) {
+        memcpy(&w32, p, 4);
+        sum += w32;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        memcpy(&w16, p, 2);
+        sum += w16;
+        p += 2;
+        len -= 2;
+    }
+    // A trailing byte is the first byte of a word padded with zero
+    if (len) {
+        w16 = 0;
+        memcpy(&w16, p, 1);
+        sum += w16;
+    }
+    return sum;
+}
+
+/* ------------------------------------ ref ------------------------------------ */
+
+uint16_t cksum_ref(const void *_data, int len) {
+    const uint8_t *data = _data;
+    uint32_t sum;
+
+    for (sum = 0;len >= 2; data += 2, len -= 2)
+        sum += data[0] << 8 | data[1];
+    if (len > 0)
+        sum += data[0] << 8;
+    while (sum > 0xffff)
+        sum = (sum >> 16) + (sum & 0xffff);
+    sum = htons (~sum);
+    return sum ? sum : 0xffff;
+}
+
+/* ------------------------------------ word ------------------------------------ */
+
+uint16_t cksum_word(const void *data, int len) {
+    return cksum_finish(words_sum(0, data, len));
+}
+
+#if CKSUM_X86
+
+/* ------------------------------------ sse2 ------------------------------------ */
+
+/**
+ * Add up the 32-bit lanes of a vector.
+ *
+ * @param   v       Vector
+ *
+ * @return  Sum of its four lanes
+*/
+__attribute__((target("sse2")))
+static uint64_t sse2_lanes(__m128i v) {
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, v);
+    return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("sse2")))
+uint16_t cksum_sse2(const void *data, int len) {
+    const uint8_t *p = data;
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        __m128i acc = _mm_setzero_si128();
+        int words;
+
+        // Every 16-bit word is widened into a 32-bit lane, each lane takes two per iteration
+        for (words = 0; len >= 16 && words < LANE_WORDS; p += 16, len -= 16, words += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i*)p);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+        }
+        sum += sse2_lanes(acc);
+    }
+    return cksum_finish(words_sum(sum, p, len));
+}
+
+static int sse2_supported(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+/* ------------------------------------ avx2 ------------------------------------ */
+
+__attribute__((target("avx2")))
+uint16_t cksum_avx2(const void *data, int len) {
+    const uint8_t *p = data;
+    uint64_t sum = 0;
+
+    while (len >= 32) {
+        __m256i acc = _mm256_setzero_si256();
+        int words;
+
+        for (words = 0; len >= 32 && words < LANE_WORDS; p += 32, len -= 32, words += 2) {
+            __m128i lo = _mm_loadu_si128((const __m128i*)p);
+            __m128i hi = _mm_loadu_si128((const __m128i*)(p + 16));
+            acc = _mm256_add_epi32(acc, _mm256_cvtepu16_epi32(lo));
+            acc = _mm256_add_epi32(acc, _mm256_cvtepu16_epi32(hi));
+        }
+        sum += sse2_lanes(_mm256_castsi256_si128(acc));
+        sum += sse2_lanes(_mm256_extracti128_si256(acc, 1));
+    }
+    return cksum_finish(words_sum(sum, p, len));
+}
+
+static int avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif /* CKSUM_X86 */
+
+/* ------------------------------------------------------------------------------- */
+
+const cksum_impl_t cksum_impls[] = {
+    { "ref", cksum_ref, NULL },
+    { "word", cksum_word, NULL },
+#if CKSUM_X86
+    { "sse2", cksum_sse2, sse2_supported },
+    { "avx2", cksum_avx2, avx2_supported },
+#endif /* CKSUM_X86 */
+    { NULL, NULL, NULL },
+};
+
+/**
+ * Pick the fastest implementation supported by the CPU.
+ *
+ * @return  Pointer to the implementation
+*/
+const cksum_impl_t* cksum_select(void) {
+    const cksum_impl_t *best = &cksum_impls[0], *impl;
+
+    for (impl = cksum_impls; impl->name; impl++) {
+        if (!impl->supported || impl->supported()) {
+            best = impl;
+        }
+    }
+    return best;
+}
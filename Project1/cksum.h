@@ -0,0 +1,51 @@
+#ifndef CKSUM_H
+#define CKSUM_H
+
+#include <stdint.h>
+
+/*
+ * Implementations of the Internet checksum returned by cksum() (rlib.h). All of them return exactly the same value
+ * as the original byte-by-byte one (cksum_ref) for any buffer shorter than 128 KiB, already in network byte order
+ * and never 0 (0xffff instead).
+ *
+ * The faster ones rely on the one's complement sum being independent of byte order: they add up the buffer in
+ * native byte order, in machine words or vector lanes wide enough that carries only need to be folded once at the
+ * end.
+ *
+ *   ref    16-bit big-endian words, one at a time (the original implementation)
+ *   word   64-bit words, each split into two 32-bit halves added to a 64-bit sum
+ *   sse2   16 bytes at a time, widened to 32-bit lanes (x86 only)
+ *   avx2   32 bytes at a time, widened to 32-bit lanes (x86 only)
+ *
+ * cksum() uses the fastest one the CPU supports, detected at runtime.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CKSUM_X86 1
+#endif
+
+typedef uint16_t (*cksum_fn_t)(const void *data, int len);
+
+typedef struct cksum_impl {
+    const char* name;
+    cksum_fn_t fn;
+    int (*supported)(void);     /* NULL if always supported */
+} cksum_impl_t;
+
+extern const cksum_impl_t cksum_impls[];   /* Terminated by an entry with a NULL name, slowest first */
+
+uint16_t cksum_ref(const void *data, int len);
+uint16_t cksum_word(const void *data, int len);
+#if CKSUM_X86
+uint16_t cksum_sse2(const void *data, int len);
+uint16_t cksum_avx2(const void *data, int len);
+#endif /* CKSUM_X86 */
+
+/**
+ * Pick the fastest implementation supported by the CPU.
+ *
+ * @return  Pointer to the implementation
+*/
+const cksum_impl_t* cksum_select(void);
+
+#endif /* CKSUM_H */
@@ -0,0 +1,105 @@
+#include "ext.h"
+
+/**
+ * Check whether a (verified) packet is a control packet.
+ *
+ * @param   pkt     Pointer to packet
+ *
+ * @return  1 iff the packet is a control packet, 0 otherwise
+*/
+int ext_is_control(const packet_t *pkt) {
+    return ntohs(pkt->len) >= EXT_HEADER_LEN && pkt->seqno == 0;
+}
+
+/**
+ * Start building a control packet without any options.
+ * Its ackno and checksum still have to be filled in (e.g. with create_packet) once all options are added.
+ *
+ * @param   pkt     Pointer to packet
+*/
+void ext_init(packet_t *pkt) {
+    pkt->cksum = 0;
+    pkt->len = htons(EXT_HEADER_LEN);
+    pkt->ackno = 0;
+    pkt->seqno = 0;
+}
+
+/**
+ * Room left for option values in a control packet under construction.
+ *
+ * @param   pkt     Pointer to packet
+ *
+ * @return  Maximum value length of one more option (0 if none fits)
+*/
+uint16_t ext_room(const packet_t *pkt) {
+    size_t used = ntohs(pkt->len) + EXT_OPT_HEADER_LEN;
+    return used < EXT_MAX_LEN ? EXT_MAX_LEN - used : 0;
+}
+
+/**
+ * Append an option to a control packet under construction.
+ *
+ * @param   pkt     Pointer to packet
+ * @param   type    Option type
+ * @param   flags   Option flags
+ * @param   len     Length of the value
+ *
+ * @return  Pointer to where the value has to be written (NULL if it does not fit)
+*/
+uint8_t* ext_add(packet_t *pkt, uint8_t type, uint8_t flags, uint16_t len) {
+    return ext_add_upto(pkt, type, flags, len, EXT_MAX_LEN);
+}
+
+/**
+ * Append an option to a control packet under construction that may grow beyond EXT_MAX_LEN (a parity packet).
+ *
+ * @param   pkt     Pointer to packet
+ * @param   type    Option type
+ * @param   flags   Option flags
+ * @param   len     Length of the value
+ * @param   max_len Longest packet the peer takes
+ *
+ * @return  Pointer to where the value has to be written (NULL if it does not fit)
+*/
+uint8_t* ext_add_upto(packet_t *pkt, uint8_t type, uint8_t flags, uint16_t len, uint16_t max_len) {
+    uint16_t offset = ntohs(pkt->len) - EXT_HEADER_LEN;
+    uint8_t* opt = (uint8_t*)pkt->data + offset;
+    size_t end = (size_t)ntohs(pkt->len) + EXT_OPT_HEADER_LEN + len;
+
+    if (end > max_len || end > EXT_HEADER_LEN + sizeof(pkt->data)) {
+        return NULL;
+    }
+    opt[0] = type;
+    opt[1] = flags;
+    opt[2] = len >> 8;
+    opt[3] = len & 0xff;
+    pkt->len = htons(EXT_HEADER_LEN + offset + EXT_OPT_HEADER_LEN + len);
+    return opt + EXT_OPT_HEADER_LEN;
+}
+
+/**
+ * Iterate over the options of a (verified) control packet.
+ *
+ * @param   pkt     Pointer to packet
+ * @param   offset  Iteration state, must be 0 for the first call
+ * @param   opt     Pointer to where the next option is stored
+ *
+ * @return  1 iff an option was stored, 0 at the end or if the rest of the packet is malformed
+*/
+int ext_next(const packet_t *pkt, uint16_t *offset, ext_opt_t *opt) {
+    uint16_t end = ntohs(pkt->len) - EXT_HEADER_LEN;
+    const uint8_t* p = (const uint8_t*)pkt->data + *offset;
+
+    if (end > sizeof(pkt->data) || *offset + EXT_OPT_HEADER_LEN > end) {
+        return 0;
+    }
+    opt->type = p[0];
+    opt->flags = p[1];
+    opt->len = (uint16_t)(p[2] << 8 | p[3]);
+    if (*offset + EXT_OPT_HEADER_LEN + opt->len > end) {
+        return 0;
+    }
+    opt->value = p + EXT_OPT_HEADER_LEN;
+    *offset += EXT_OPT_HEADER_LEN + opt->len;
+    return 1;
+}
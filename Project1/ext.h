@@ -0,0 +1,139 @@
+#ifndef EXT_H
+#define EXT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "rlib.h"
+
+/*
+ * Optional protocol extensions, carried in control packets.
+ *
+ * A control packet is a packet of at least 12 bytes whose seqno is 0. Data packets are numbered from 1, so
+ * implementations without extensions treat a control packet as an old duplicate and drop it without a reply. The
+ * ackno of a control packet is a valid cumulative acknowledgement, like in an Ack packet. The payload is a list of
+ * options, each a 4-byte header (type, flags, 16-bit value length in big-endian order) followed by the value:
+ *
+ *   EXT_OPT_CAPS   32-bit big-endian bitmask of the extensions (EXT_CAP_*) the sender supports and has enabled.
+ *                  Each side sends its capabilities before its first packet and answers capabilities without
+ *                  EXT_CAPS_ACK in their flags with its own, with EXT_CAPS_ACK set. An extension is only used once
+ *                  both sides have announced it.
+ *
+ *   EXT_OPT_SACK   Selective acknowledgement: a bitmap of the receive window following ackno. The most significant
+ *                  bit of the first byte stands for seqno ackno + 1, the next bit for ackno + 2, and so on. A set bit
+ *                  means that the packet has been received and is buffered, so it need not be retransmitted.
+ *
+ *   EXT_OPT_RWND   Receive window: 32-bit big-endian number of data packets, starting at ackno, that the sender of
+ *                  the option can take without dropping them for lack of output space. Every acknowledgement carries
+ *                  it once EXT_CAP_RWND is used. A sender facing a window of 0 sends no data but, with backoff,
+ *                  window probes: control packets with this option (carrying its own window) and the flag
+ *                  EXT_RWND_PROBE, which the receiver answers with an acknowledgement carrying its current window.
+ *
+ *   EXT_OPT_MSS    16-bit big-endian largest payload of a data packet the sender of the option takes, sent along
+ *                  with its capabilities if it has EXT_CAP_MSS enabled. Once both sides announced EXT_CAP_MSS, data
+ *                  packets carry up to the smaller of both values; until then, and otherwise, up to 500 bytes.
+ *
+ *   EXT_OPT_FEC    Forward error correction (see fec.h). Sent along with the capabilities if EXT_CAP_FEC is enabled:
+ *                  16-bit big-endian group size of the sender's parity packets. With the flag EXT_FEC_PARITY: the
+ *                  parity of a group of data packets, which the receiver uses to rebuild one lost packet of it.
+ *                  Once both sides announced EXT_CAP_FEC, data packets carry EXT_OPT_HEADER_LEN + FEC_HEADER_LEN
+ *                  bytes less than otherwise, so that a parity packet is no longer than a full data packet.
+ *
+ * Control packets never exceed EXT_MAX_LEN bytes, so that any peer takes them whatever its payload size. Parity packets
+ * are the exception: only sent to a peer using EXT_CAP_FEC, they are as long as its data packets.
+*/
+
+#define EXT_OPT_CAPS 1
+#define EXT_OPT_SACK 2
+#define EXT_OPT_RWND 3
+#define EXT_OPT_MSS 4
+#define EXT_OPT_FEC 5
+
+#define EXT_CAPS_ACK 0x01       /* Flag of EXT_OPT_CAPS: the sender already knows the receiver's capabilities */
+#define EXT_RWND_PROBE 0x01     /* Flag of EXT_OPT_RWND: window probe, answer with an acknowledgement */
+#define EXT_FEC_PARITY 0x01     /* Flag of EXT_OPT_FEC: parity of a group instead of the group size */
+
+#define EXT_CAP_SACK 0x00000001
+#define EXT_CAP_RWND 0x00000002
+#define EXT_CAP_MSS 0x00000004
+#define EXT_CAP_FEC 0x00000008
+
+#define EXT_HEADER_LEN 12       /* Length of the packet header before the options */
+#define EXT_OPT_HEADER_LEN 4    /* Length of an option header */
+#define EXT_MAX_LEN (EXT_HEADER_LEN + PACKET_DATA_DEFAULT)  /* Longest control packet */
+
+typedef struct ext_opt {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t len;               /* Length of the value */
+    const uint8_t* value;
+} ext_opt_t;
+
+/**
+ * Check whether a (verified) packet is a control packet.
+ *
+ * @param   pkt     Pointer to packet
+ *
+ * @return  1 iff the packet is a control packet, 0 otherwise
+*/
+int ext_is_control(const packet_t *pkt);
+
+/**
+ * Start building a control packet without any options.
+ * Its ackno and checksum still have to be filled in (e.g. with create_packet) once all options are added.
+ *
+ * @param   pkt     Pointer to packet
+*/
+void ext_init(packet_t *pkt);
+
+/**
+ * Room left for option values in a control packet under construction.
+ *
+ * @param   pkt     Pointer to packet
+ *
+ * @return  Maximum value length of one more option (0 if none fits)
+*/
+uint16_t ext_room(const packet_t *pkt);
+
+/**
+ * Append an option to a control packet under construction.
+ *
+ * @param   pkt     Pointer to packet
+ * @param   type    Option type
+ * @param   flags   Option flags
+ * @param   len     Length of the value
+ *
+ * @return  Pointer to where the value has to be written (NULL if it does not fit)
+*/
+uint8_t* ext_add(packet_t *pkt, uint8_t type, uint8_t flags, uint16_t len);
+
+/**
+ * Append an option to a control packet under construction that may grow beyond EXT_MAX_LEN (a parity packet).
+ *
+ * @param   pkt     Pointer to packet
+ * @param   type    Option type
+ * @param   flags   Option flags
+ * @param   len     Length of the value
+ * @param   max_len Longest packet the peer takes
+ *
+ * @return  Pointer to where the value has to be written (NULL if it does not fit)
+*/
+uint8_t* ext_add_upto(packet_t *pkt, uint8_t type, uint8_t flags, uint16_t len, uint16_t max_len);
+
+/**
+ * Iterate over the options of a (verified) control packet.
+ *
+ * @param   pkt     Pointer to packet
+ * @param   offset  Iteration state, must be 0 for the first call
+ * @param   opt     Pointer to where the next option is stored
+ *
+ * @return  1 iff an option was stored, 0 at the end or if the rest of the packet is malformed
+*/
+int ext_next(const packet_t *pkt, uint16_t *offset, ext_opt_t *opt);
+
+#endif /* EXT_H */
@@ -0,0 +1,245 @@
+#include "fec.h"
+
+/**
+ * XOR len bytes of src into dst, a word at a time.
+ *
+ * @param   dst         Pointer to destination
+ * @param   src         Pointer to source
+ * @param   len         Number of bytes
+*/
+static void fec_xor(char *dst, const char *src, uint16_t len) {
+    uint16_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+/**
+ * Retrieve the first sequence number of a group.
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   id          Group
+ *
+ * @return  Sequence number
+*/
+static uint32_t fec_first(const fec_t *fec, uint32_t id) {
+    uint32_t seqno = id * fec->k;
+    return seqno == 0 ? 1 : seqno;
+}
+
+/**
+ * Empty a group slot and assign it to a group.
+ *
+ * @param   g           Pointer to group
+ * @param   id          Group
+*/
+static void fec_reset(fec_group_t *g, uint32_t id) {
+    memset(g->parity, 0, g->plen);
+    g->id = id;
+    g->count = 0;
+    g->lens = 0;
+    g->plen = 0;
+    g->seqnos = 0;
+}
+
+/**
+ * Add a data packet to a group.
+ *
+ * @param   g           Pointer to group
+ * @param   pkt         Pointer to packet
+*/
+static void fec_absorb(fec_group_t *g, const packet_t *pkt) {
+    uint16_t plen = ntohs(pkt->len) - 12;
+
+    fec_xor(g->parity, pkt->data, plen);
+    if (plen > g->plen) {
+        g->plen = plen;
+    }
+    g->count++;
+    g->lens ^= plen;
+    g->seqnos ^= ntohl(pkt->seqno);
+}
+
+/**
+ * Initialize a sending (ngroups 1) or receiving side.
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   k           Group size, 1 to FEC_MAX_GROUP
+ * @param   ngroups     Number of groups kept: 1 for sending, window / k + 2 for receiving
+ * @param   max_payload Longest payload of a data packet
+*/
+void fec_init(fec_t *fec, uint16_t k, uint32_t ngroups, uint16_t max_payload) {
+    uint32_t i;
+
+    fec->k = k;
+    fec->max_payload = max_payload;
+    fec->ngroups = ngroups;
+    fec->groups = xmalloc(ngroups * sizeof(fec_group_t));
+    fec->mem = xmalloc((size_t)ngroups * max_payload);
+    memset(fec->mem, 0, (size_t)ngroups * max_payload);
+    for (i = 0; i < ngroups; i++) {
+        fec->groups[i].parity = fec->mem + (size_t)i * max_payload;
+        fec->groups[i].plen = 0;
+        fec_reset(&fec->groups[i], 0);
+    }
+}
+
+/**
+ * Release the groups.
+ *
+ * @param   fec         Pointer to FEC state
+*/
+void fec_destroy(fec_t *fec) {
+    free(fec->groups);
+    free(fec->mem);
+}
+
+/**
+ * Add a data packet sent for the first time to its group (sending side).
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   pkt         Pointer to packet (in network byte order)
+ *
+ * @return  1 iff the packet completes its group, whose parity has to be sent now with fec_parity
+*/
+int fec_add_sent(fec_t *fec, const packet_t *pkt) {
+    fec_group_t* g = fec->groups;
+    uint32_t seqno = ntohl(pkt->seqno);
+    uint32_t id = seqno / fec->k;
+
+    if (g->count == 0 || g->id != id) {
+        // Joining a group halfway would leave out packets the receiver counts in
+        if (seqno != fec_first(fec, id)) {
+            return 0;
+        }
+        fec_reset(g, id);
+    }
+    fec_absorb(g, pkt);
+    return seq_next(seqno) / fec->k != id;
+}
+
+/**
+ * Check whether the sending side has a group that was started but not completed, e.g. to end it at EOF.
+ *
+ * @param   fec         Pointer to FEC state
+ *
+ * @return  1 iff fec_parity would send the parity of some packets
+*/
+int fec_pending(const fec_t *fec) {
+    return fec->groups[0].count > 0;
+}
+
+/**
+ * Length of the option value fec_parity writes for the current group (sending side).
+ *
+ * @param   fec         Pointer to FEC state
+ *
+ * @return  FEC_HEADER_LEN plus the longest payload of the group
+*/
+uint16_t fec_parity_len(const fec_t *fec) {
+    return FEC_HEADER_LEN + fec->groups[0].plen;
+}
+
+/**
+ * Write the parity of the current group and end the group (sending side).
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   value       Where to write fec_parity_len bytes, NULL to drop the group
+*/
+void fec_parity(fec_t *fec, uint8_t *value) {
+    fec_group_t* g = fec->groups;
+    uint32_t first = fec_first(fec, g->id);
+
+    if (value) {
+        value[0] = first >> 24;
+        value[1] = first >> 16;
+        value[2] = first >> 8;
+        value[3] = first;
+        value[4] = g->count >> 8;
+        value[5] = g->count;
+        value[6] = g->lens >> 8;
+        value[7] = g->lens;
+        memcpy(value + FEC_HEADER_LEN, g->parity, g->plen);
+    }
+    fec_reset(g, g->id);
+}
+
+/**
+ * Add a data packet received for the first time to its group (receiving side).
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   pkt         Pointer to packet (in network byte order)
+*/
+void fec_add_received(fec_t *fec, const packet_t *pkt) {
+    uint32_t id = ntohl(pkt->seqno) / fec->k;
+    fec_group_t* g = &fec->groups[id % fec->ngroups];
+
+    // A slot is taken over by a newer group once the older one lies behind the receive window
+    if (g->count == 0 || g->id != id) {
+        fec_reset(g, id);
+    }
+    fec_absorb(g, pkt);
+}
+
+/**
+ * Rebuild the missing packet of a group from its parity (receiving side).
+ * Only the seqno, len and payload of the packet are filled in; its ackno and checksum are left to the caller.
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   value       Parity option value
+ * @param   len         Its length
+ * @param   pkt         Pointer to where the packet is rebuilt (room for max_payload)
+ *
+ * @return  1 iff exactly one packet of the group was missing and has been rebuilt, 0 otherwise
+*/
+int fec_repair(fec_t *fec, const uint8_t *value, uint16_t len, packet_t *pkt) {
+    uint32_t first, id, seqnos, missing, seqno;
+    uint16_t count, lens, plen, mlen, i;
+    fec_group_t* g;
+
+    if (len < FEC_HEADER_LEN || len - FEC_HEADER_LEN > fec->max_payload) {
+        return 0;
+    }
+    first = (uint32_t)value[0] << 24 | value[1] << 16 | value[2] << 8 | value[3];
+    count = value[4] << 8 | value[5];
+    lens = value[6] << 8 | value[7];
+    plen = len - FEC_HEADER_LEN;
+    id = first / fec->k;
+    g = &fec->groups[id % fec->ngroups];
+    if (first == 0 || count == 0 || count > fec->k) {
+        return 0;
+    }
+    // A slot holding another group holds none of this one's packets
+    if (g->count == 0 || g->id != id) {
+        g = NULL;
+    }
+    if ((g ? g->count : 0) != count - 1) {
+        return 0;
+    }
+
+    // The sequence numbers, lengths and payloads of all packets but the missing one cancel out
+    seqnos = 0;
+    for (i = 0, seqno = first; i < count; i++, seqno = seq_next(seqno)) {
+        seqnos ^= seqno;
+    }
+    missing = seqnos ^ (g ? g->seqnos : 0);
+    mlen = lens ^ (g ? g->lens : 0);
+    if (missing == 0 || missing / fec->k != id || mlen > plen) {
+        return 0;
+    }
+    memcpy(pkt->data, value + FEC_HEADER_LEN, mlen);
+    if (g) {
+        fec_xor(pkt->data, g->parity, mlen);
+    }
+    pkt->seqno = htonl(missing);
+    pkt->len = htons(12 + mlen);
+    return 1;
+}
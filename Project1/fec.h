@@ -0,0 +1,132 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "rlib.h"
+#include "seq.h"
+
+/*
+ * Forward error correction with XOR parity groups.
+ *
+ * Data packets are grouped by sequence number: with a group size of k, group i holds the sequence numbers n with
+ * n / k == i (sequence number 0 is skipped, so the group holding it has one packet less). Both sides know the groups
+ * without telling each other where they start, which lets the receiver add up packets as they arrive, including the
+ * ones it writes out right away and does not keep.
+ *
+ * Once the sender has sent all packets of a group for the first time (or EOF ends the group early), it sends their
+ * parity: the XOR of their payloads, each padded with zeros to the longest, and of their payload lengths. A receiver
+ * holding all packets of the group but one rebuilds the missing one from the parity and the XOR of the others, without
+ * waiting for its retransmission. Losing two packets of a group, or a packet and the parity, leaves it to the
+ * retransmissions.
+ *
+ * The sender only starts a group with its first sequence number, so that packets sent before FEC was in use never
+ * mix into a parity. The receiver keeps enough groups for a whole receive window: a group whose missing packet is
+ * still awaited lies within it.
+ *
+ * The parity is sent as an option value (see EXT_OPT_FEC in ext.h): 32-bit big-endian first sequence number of the
+ * group, 16-bit big-endian number of packets it covers, 16-bit big-endian XOR of their payload lengths, followed by
+ * the XOR of their payloads (FEC_HEADER_LEN + longest payload bytes).
+*/
+
+#define FEC_HEADER_LEN 8        /* Length of the group header in front of the parity bytes */
+#define FEC_MAX_GROUP 64        /* Largest group size */
+
+typedef struct fec_group {
+    uint32_t id;                /* Sequence number / group size */
+    uint16_t count;             /* Packets added, 0 if the group is unused */
+    uint16_t lens;              /* XOR of their payload lengths */
+    uint16_t plen;              /* Longest payload among them, the length of the parity */
+    uint32_t seqnos;            /* XOR of their sequence numbers */
+    char* parity;               /* XOR of their payloads, zero beyond plen */
+} fec_group_t;
+
+typedef struct fec {
+    uint16_t k;                 /* Group size */
+    uint16_t max_payload;       /* Longest payload of a data packet */
+    uint32_t ngroups;           /* Groups kept, slot id % ngroups */
+    fec_group_t* groups;
+    char* mem;                  /* Parity bytes of all groups */
+} fec_t;
+
+/**
+ * Initialize a sending (ngroups 1) or receiving side.
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   k           Group size, 1 to FEC_MAX_GROUP
+ * @param   ngroups     Number of groups kept: 1 for sending, window / k + 2 for receiving
+ * @param   max_payload Longest payload of a data packet
+*/
+void fec_init(fec_t *fec, uint16_t k, uint32_t ngroups, uint16_t max_payload);
+
+/**
+ * Release the groups.
+ *
+ * @param   fec         Pointer to FEC state
+*/
+void fec_destroy(fec_t *fec);
+
+/**
+ * Add a data packet sent for the first time to its group (sending side).
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   pkt         Pointer to packet (in network byte order)
+ *
+ * @return  1 iff the packet completes its group, whose parity has to be sent now with fec_parity
+*/
+int fec_add_sent(fec_t *fec, const packet_t *pkt);
+
+/**
+ * Check whether the sending side has a group that was started but not completed, e.g. to end it at EOF.
+ *
+ * @param   fec         Pointer to FEC state
+ *
+ * @return  1 iff fec_parity would send the parity of some packets
+*/
+int fec_pending(const fec_t *fec);
+
+/**
+ * Length of the option value fec_parity writes for the current group (sending side).
+ *
+ * @param   fec         Pointer to FEC state
+ *
+ * @return  FEC_HEADER_LEN plus the longest payload of the group
+*/
+uint16_t fec_parity_len(const fec_t *fec);
+
+/**
+ * Write the parity of the current group and end the group (sending side).
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   value       Where to write fec_parity_len bytes, NULL to drop the group
+*/
+void fec_parity(fec_t *fec, uint8_t *value);
+
+/**
+ * Add a data packet received for the first time to its group (receiving side).
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   pkt         Pointer to packet (in network byte order)
+*/
+void fec_add_received(fec_t *fec, const packet_t *pkt);
+
+/**
+ * Rebuild the missing packet of a group from its parity (receiving side).
+ * Only the seqno, len and payload of the packet are filled in; its ackno and checksum are left to the caller.
+ *
+ * @param   fec         Pointer to FEC state
+ * @param   value       Parity option value
+ * @param   len         Its length
+ * @param   pkt         Pointer to where the packet is rebuilt (room for max_payload)
+ *
+ * @return  1 iff exactly one packet of the group was missing and has been rebuilt, 0 otherwise
+*/
+int fec_repair(fec_t *fec, const uint8_t *value, uint16_t len, packet_t *pkt);
+
+#endif /* FEC_H */
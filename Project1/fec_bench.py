@@ -0,0 +1,150 @@
+import os
+import random
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from loss_bench import LossyRelay
+
+# Compares forward error correction (--fec) with retransmissions alone on a lossy path with some delay, through the
+# relay of loss_bench.py, which drops packets at random in both directions and delays the rest:
+#
+#   goodput   a file sent in bulk, in MB/s from the first byte sent until the last one arrived
+#   latency   records written to the sender at a steady rate, each stamped with the time it was written; the
+#             percentiles of how long until each one came out of the receiver (the tail is what FEC shortens:
+#             a lost packet is rebuilt one parity packet later instead of one retransmission timeout later)
+#
+# usage: python3 fec_bench.py [reliable] [delay-ms] [size-bytes] [window] [group sizes...]
+
+STATS = re.compile(r"retransmitted (\d+) packets")
+LOSSES = (1, 5, 10)
+RECORD = 1000           # Bytes per record of the latency workload
+RECORDS = 1000          # Records sent
+RECORD_GAP = 0.004      # Seconds between records
+
+
+def start(reliable, loss, delay, window, seed, extra, stdin):
+    """Starts a relay, a receiver and a sender reading from stdin."""
+    port_a = 20000 + random.randrange(20000)
+    port_b = port_a + 1
+    relay = LossyRelay(port_a, port_b, loss, seed, delay)
+    relay.start()
+    # The receiver has nothing to send, the sender's output is discarded
+    receiver = subprocess.Popen([reliable, "-w", str(window), "--stats"] + extra
+                                + [str(port_b), "localhost:%d" % relay.port(relay.side_b)],
+                                stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    log = tempfile.TemporaryFile()
+    sender = subprocess.Popen([reliable, "-w", str(window), "--stats"] + extra
+                              + [str(port_a), "localhost:%d" % relay.port(relay.side_a)],
+                              stdin=stdin, stdout=subprocess.DEVNULL, stderr=log)
+    return relay, receiver, sender, log
+
+
+def stop(relay, receiver, sender, log):
+    """Waits for the sender to finish and returns how many packets it retransmitted."""
+    try:
+        sender.wait(timeout=10)
+    except subprocess.TimeoutExpired:
+        sender.kill()
+        sender.wait()
+    log.seek(0)
+    stderr = log.read().decode()
+    receiver.kill()
+    receiver.wait()
+    receiver.stdout.close()
+    relay.running = False
+    relay.join()
+    match = STATS.search(stderr)
+    if not match:
+        print("no statistics from sender: %s" % stderr.strip())
+        sys.exit(1)
+    return int(match.group(1))
+
+
+def goodput(reliable, data, size, loss, delay, window, seed, extra):
+    data.seek(0)
+    expected = data.read()
+    data.seek(0)
+    relay, receiver, sender, log = start(reliable, loss, delay, window, seed, extra, data)
+    begin = time.time()
+    received = bytearray()
+    while len(received) < size:
+        chunk = receiver.stdout.read1(65536)
+        if not chunk:
+            break
+        received += chunk
+    elapsed = time.time() - begin
+    resent = stop(relay, receiver, sender, log)
+    if received != expected:
+        print("transfer corrupted: received %d of %d bytes" % (len(received), size))
+        sys.exit(1)
+    return size / 2 ** 20 / elapsed, resent
+
+
+def latency(reliable, loss, delay, window, seed, extra):
+    relay, receiver, sender, log = start(reliable, loss, delay, window, seed, extra, subprocess.PIPE)
+    padding = bytes(RECORD - 16)
+
+    def write():
+        begin = time.monotonic()
+        for i in range(RECORDS):
+            pause = begin + i * RECORD_GAP - time.monotonic()
+            if pause > 0:
+                time.sleep(pause)
+            sender.stdin.write(struct.pack(">Qd", i, time.monotonic()) + padding)
+            sender.stdin.flush()
+        sender.stdin.close()
+
+    writer = threading.Thread(target=write, daemon=True)
+    writer.start()
+    delays = []
+    pending = bytearray()
+    while len(delays) < RECORDS:
+        chunk = receiver.stdout.read1(65536)
+        if not chunk:
+            break
+        now = time.monotonic()
+        pending += chunk
+        while len(pending) >= RECORD:
+            index, stamp = struct.unpack(">Qd", pending[:16])
+            if index != len(delays):
+                print("records out of order: got %d, expected %d" % (index, len(delays)))
+                sys.exit(1)
+            delays.append((now - stamp) * 1000)
+            del pending[:RECORD]
+    writer.join()
+    stop(relay, receiver, sender, log)
+    if len(delays) < RECORDS:
+        print("only %d of %d records arrived" % (len(delays), RECORDS))
+        sys.exit(1)
+    delays.sort()
+    return [delays[int(len(delays) * p / 100) - (p == 100)] for p in (50, 99, 100)]
+
+
+def main(reliable, delay_ms, size, window, groups):
+    # The sender reads the bulk transfer from a file, so that it is never blocked on the benchmark itself
+    data = tempfile.TemporaryFile()
+    data.write(os.urandom(size))
+    modes = [("retransmit", [])] + [("fec %d" % k, ["--fec", str(k)]) for k in groups]
+    print("%d ms each way, window %d; goodput of %d bytes, latency of %d records of %d bytes every %g ms"
+          % (delay_ms, window, size, RECORDS, RECORD, RECORD_GAP * 1000))
+    print("%5s  %-10s  %10s  %8s  %9s  %9s  %9s" % ("loss", "mode", "goodput", "resent", "p50", "p99", "max"))
+    for loss in LOSSES:
+        for name, extra in modes:
+            rate, resent = goodput(reliable, data, size, loss / 100.0, delay_ms / 1000.0, window, loss, extra)
+            p50, p99, worst = latency(reliable, loss / 100.0, delay_ms / 1000.0, window, loss, extra)
+            print("%4d%%  %-10s  %5.2f MB/s  %8d  %7.1fms  %7.1fms  %7.1fms"
+                  % (loss, name, rate, resent, p50, p99, worst))
+
+
+if __name__ == "__main__":
+    reliable = sys.argv[1] if len(sys.argv) > 1 else "./reliable"
+    delay_ms = float(sys.argv[2]) if len(sys.argv) > 2 else 10
+    size = int(sys.argv[3]) if len(sys.argv) > 3 else 2000000
+    window = int(sys.argv[4]) if len(sys.argv) > 4 else 64
+    groups = [int(k) for k in sys.argv[5:]] or [8, 4]
+    main(reliable, delay_ms, size, window, groups)
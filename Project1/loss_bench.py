@@ -0,0 +1,153 @@
+import heapq
+import os
+import random
+import re
+import select
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+# Transfers a file between two instances of reliable through a UDP relay that drops packets at random, once with
+# plain cumulative acknowledgements and once with --sack, and compares how much the sender had to retransmit. The
+# late modes start the receiver LATE_START seconds after the sender, so that the whole first window is lost and the
+# transfer begins with a retransmission timeout before any round trip was measured.
+#
+# usage: python3 loss_bench.py [reliable] [loss-percent] [size-bytes] [window] [runs]
+
+STATS = re.compile(r"retransmitted (\d+) packets \((\d+) bytes\)")
+LATE_START = 0.1        # Seconds the receiver starts after the sender in the late modes
+SENDER_WAIT = 30        # Seconds to wait for the sender to finish lingering before the run counts as timed out
+
+
+class LossyRelay(threading.Thread):
+    """Forwards datagrams between two ports on localhost, dropping each with the given probability and delaying the
+    rest by the given time in seconds, if any. The other benchmarks use it, too."""
+
+    def __init__(self, port_a, port_b, loss, seed, delay=0):
+        threading.Thread.__init__(self, daemon=True)
+        self.side_a = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.side_a.bind(("127.0.0.1", 0))
+        self.side_b = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.side_b.bind(("127.0.0.1", 0))
+        self.peer = {self.side_a: ("127.0.0.1", port_a), self.side_b: ("127.0.0.1", port_b)}
+        self.other = {self.side_a: self.side_b, self.side_b: self.side_a}
+        self.loss = loss
+        self.delay = delay
+        self.random = random.Random(seed)
+        self.queue = []
+        self.order = 0
+        self.running = True
+
+    def port(self, sock):
+        return sock.getsockname()[1]
+
+    def run(self):
+        while self.running:
+            now = time.monotonic()
+            while self.queue and self.queue[0][0] <= now:
+                _, _, out, data = heapq.heappop(self.queue)
+                try:
+                    out.sendto(data, self.peer[out])
+                except OSError:
+                    pass
+            timeout = min(0.1, self.queue[0][0] - now) if self.queue else 0.1
+            ready, _, _ = select.select([self.side_a, self.side_b], [], [], max(timeout, 0))
+            for sock in ready:
+                # Room for the largest packet --mss allows
+                data = sock.recv(16384)
+                if self.random.random() >= self.loss:
+                    self.order += 1
+                    heapq.heappush(self.queue, (time.monotonic() + self.delay, self.order, self.other[sock], data))
+
+
+def transfer(reliable, data, loss, window, seed, extra, late):
+    port_a = 20000 + random.randrange(20000)
+    port_b = port_a + 1
+    relay = LossyRelay(port_a, port_b, loss, seed)
+    relay.start()
+    data.seek(0)
+    expected = data.read()
+    data.seek(0)
+
+    # The receiver has nothing to send, the sender's output is discarded
+    def start_receiver():
+        return subprocess.Popen([reliable, "-w", str(window), "--stats"] + extra
+                                + [str(port_b), "localhost:%d" % relay.port(relay.side_b)],
+                                stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+
+    receiver = None if late else start_receiver()
+    log = tempfile.TemporaryFile()
+    sender = subprocess.Popen([reliable, "-w", str(window), "--stats"] + extra
+                              + [str(port_a), "localhost:%d" % relay.port(relay.side_a)],
+                              stdin=data, stdout=subprocess.DEVNULL, stderr=log)
+    # Time until all data arrived, from when the sender started, not including how long the connections linger
+    # afterwards
+    start = time.time()
+    if late:
+        time.sleep(late)
+        receiver = start_receiver()
+    received = b""
+    while len(received) < len(expected):
+        chunk = receiver.stdout.read1(65536)
+        if not chunk:
+            break
+        received += chunk
+    elapsed = time.time() - start
+
+    # The sender lingers for three timeouts after the transfer, which after a lossy shutdown can take longer than
+    # the benchmark is willing to wait: its statistics are then missing and the run is reported as timed out
+    try:
+        sender.wait(timeout=SENDER_WAIT)
+    except subprocess.TimeoutExpired:
+        sender.kill()
+        sender.wait()
+    log.seek(0)
+    stderr = log.read().decode()
+    receiver.kill()
+    receiver.wait()
+    receiver.stdout.close()
+    relay.running = False
+    relay.join()
+
+    if received != expected:
+        print("transfer corrupted: received %d of %d bytes" % (len(received), len(expected)))
+        sys.exit(1)
+    match = STATS.search(stderr)
+    if not match:
+        return None, None, elapsed
+    return int(match.group(1)), int(match.group(2)), elapsed
+
+
+def main(reliable, loss_percent, size, window, runs):
+    # The sender reads from a file, so that it is never blocked on the benchmark itself
+    data = tempfile.TemporaryFile()
+    data.write(os.urandom(size))
+    print("%d bytes, window %d, %g%% loss in each direction, %d runs" % (size, window, loss_percent, runs))
+    print("%-10s  %16s  %16s  %10s  %9s" % ("mode", "packets resent", "bytes resent", "time", "timed out"))
+    for name, extra, late in (("plain", [], 0), ("sack", ["--sack"], 0),
+                              ("late", [], LATE_START), ("late sack", ["--sack"], LATE_START)):
+        packets = retransmitted = elapsed = timed_out = 0
+        for run in range(runs):
+            p, b, t = transfer(reliable, data, loss_percent / 100.0, window, run, extra, late)
+            elapsed += t
+            if p is None:
+                timed_out += 1
+                continue
+            packets += p
+            retransmitted += b
+        # Runs whose sender timed out have no statistics and are left out of the averages of what was resent
+        counted = max(runs - timed_out, 1)
+        print("%-10s  %16.1f  %16.1f  %9.2fs  %9d" % (name, packets / counted, retransmitted / counted,
+                                                      elapsed / runs, timed_out))
+
+
+if __name__ == "__main__":
+    reliable = sys.argv[1] if len(sys.argv) > 1 else "./reliable"
+    loss_percent = float(sys.argv[2]) if len(sys.argv) > 2 else 5
+    size = int(sys.argv[3]) if len(sys.argv) > 3 else 1000000
+    window = int(sys.argv[4]) if len(sys.argv) > 4 else 32
+    runs = int(sys.argv[5]) if len(sys.argv) > 5 else 3
+    main(reliable, loss_percent, size, window, runs)
@@ -0,0 +1,92 @@
+#include "pool.h"
+
+/**
+ * Carve a new slab into blocks and put them all on the free list.
+ *
+ * @param   pool        Pointer to pool
+*/
+static void pool_grow(pool_t *pool) {
+    uint32_t i;
+    pool_slab_t* slab = xmalloc(sizeof(pool_slab_t) + (size_t)pool->slab_blocks * pool->block_size);
+    char* block = (char*)(slab + 1);
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    for (i = 0; i < pool->slab_blocks; i++, block += pool->block_size) {
+        *(void**)block = pool->free_list;
+        pool->free_list = block;
+    }
+    pool->capacity += pool->slab_blocks;
+    pool->heap_allocs++;
+}
+
+/**
+ * Initialize a pool with one slab of blocks.
+ *
+ * @param   pool        Pointer to pool
+ * @param   block_size  Size of each block in bytes
+ * @param   nblocks     Number of blocks per slab
+*/
+void pool_init(pool_t *pool, size_t block_size, uint32_t nblocks) {
+    // Every block must be able to hold the free list link and stay aligned
+    const size_t align = sizeof(void*);
+    if (block_size < sizeof(void*)) {
+        block_size = sizeof(void*);
+    }
+    pool->block_size = (block_size + align - 1) / align * align;
+    pool->slab_blocks = nblocks > 0 ? nblocks : 1;
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->capacity = 0;
+    pool->in_use = 0;
+    pool->heap_allocs = 0;
+    pool_grow(pool);
+}
+
+/**
+ * Get a block from the pool, growing it by another slab if none is free.
+ *
+ * @param   pool        Pointer to pool
+ *
+ * @return  Pointer to block (never NULL)
+*/
+void* pool_get(pool_t *pool) {
+    void* block;
+    if (pool->free_list == NULL) {
+        pool_grow(pool);
+    }
+    block = pool->free_list;
+    pool->free_list = *(void**)block;
+    pool->in_use++;
+    return block;
+}
+
+/**
+ * Put a block obtained via pool_get() back into the pool.
+ *
+ * @param   pool        Pointer to pool
+ * @param   block       Pointer to block
+*/
+void pool_put(pool_t *pool, void *block) {
+    *(void**)block = pool->free_list;
+    pool->free_list = block;
+    pool->in_use--;
+}
+
+/**
+ * Release all slabs of the pool.
+ *
+ * @param   pool        Pointer to pool
+*/
+void pool_destroy(pool_t *pool) {
+    pool_slab_t* slab = pool->slabs;
+    while (slab != NULL) {
+        pool_slab_t* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->capacity = 0;
+    pool->in_use = 0;
+}
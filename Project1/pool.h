@@ -0,0 +1,71 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "rlib.h"
+
+/*
+ * A pool hands out fixed-size blocks from slabs allocated up front.
+ *
+ * Freed blocks go back onto a free list and are handed out again, so once a pool has been sized for the steady
+ * state (e.g. twice the window of a connection) getting and putting blocks never touches the heap. Should the pool
+ * run dry it grows by another slab of the initial size; the number of heap allocations ever made is kept in
+ * heap_allocs so that it can be checked to stay flat.
+ *
+ * All slabs are released at once with pool_destroy(pool), whether or not their blocks have been put back.
+*/
+
+typedef struct pool_slab {
+    struct pool_slab* next;
+} pool_slab_t;
+
+typedef struct pool {
+    size_t block_size;          /* Size of each block handed out */
+    uint32_t slab_blocks;       /* Number of blocks per slab */
+    void* free_list;            /* Blocks ready to be handed out */
+    pool_slab_t* slabs;         /* All slabs owned by the pool */
+    uint32_t capacity;          /* Number of blocks owned */
+    uint32_t in_use;            /* Number of blocks handed out */
+    unsigned long heap_allocs;  /* Number of heap allocations made by the pool */
+} pool_t;
+
+/**
+ * Initialize a pool with one slab of blocks.
+ *
+ * @param   pool        Pointer to pool
+ * @param   block_size  Size of each block in bytes
+ * @param   nblocks     Number of blocks per slab
+*/
+void pool_init(pool_t *pool, size_t block_size, uint32_t nblocks);
+
+/**
+ * Get a block from the pool, growing it by another slab if none is free.
+ *
+ * @param   pool        Pointer to pool
+ *
+ * @return  Pointer to block (never NULL)
+*/
+void* pool_get(pool_t *pool);
+
+/**
+ * Put a block obtained via pool_get() back into the pool.
+ *
+ * @param   pool        Pointer to pool
+ * @param   block       Pointer to block
+*/
+void pool_put(pool_t *pool, void *block);
+
+/**
+ * Release all slabs of the pool.
+ *
+ * @param   pool        Pointer to pool
+*/
+void pool_destroy(pool_t *pool);
+
+#endif /* POOL_H */
@@ -16,21 +16,100 @@
 
 #include "rlib.h"
 #include "buffer.h"
+#include "cc.h"
+#include "ext.h"
+#include "fec.h"
+#include "pool.h"
+#include "rtt.h"
+#include "seq.h"
+#include "timer_wheel.h"
 
 //Helper functions, defined at the bottom of the file
 
 
 bool isDone(rel_t* r);
+void finish_if_done(rel_t* r);
+void linger_expired(tw_timer_t* timer, void* arg);
 bool should_send_packet(rel_t* s);
+int input_fill(rel_t* s);
+int input_take(rel_t* s, char* data);
+int stream_fill(rel_t* s);
+void stream_output(rel_t* r);
+bool nagle_holds(rel_t* s, int avail);
+void nagle_flush(tw_timer_t* timer, void* arg);
+int send_window(rel_t* s);
+int payload_size(rel_t* r);
+bool pace_allows(rel_t* s);
+void pace_resume(tw_timer_t* timer, void* arg);
 bool enough_space(rel_t* r, packet_t* pkt);
 bool is_ACK(packet_t* packet);
 int is_EOF(packet_t* packet);
-int MAX(int num1, int num2);
-void create_packet(packet_t* packet, int len, int seqno, int ackno, int isData);
+void create_packet(packet_t* packet, int len, uint32_t seqno, uint32_t ackno, int isData);
 void send_packet(packet_t* packet, rel_t* s);
 void create_send_ack(rel_t* r);
+void delay_ack(rel_t* r);
+void delack_expired(tw_timer_t* timer, void* arg);
+int recv_window(rel_t* r);
+void window_update(rel_t* r);
+void peer_window(rel_t* s, int rwnd);
+void persist_probe(tw_timer_t* timer, void* arg);
+void retransmit_packet(tw_timer_t* timer, void* arg);
+void resend_packet(rel_t* s, buffer_node_t* node, long now);
+void arm_retransmit(rel_t* s, buffer_node_t* node);
+void rearm_retransmits(rel_t* s);
+bool ack_driven_recovery(rel_t* s);
+void resend_flight(rel_t* s, long now);
+void arm_tail_probe(rel_t* s);
+void tail_probe(tw_timer_t* timer, void* arg);
+void process_ack(rel_t* s, uint32_t ackno, bool for_data);
+void process_control(rel_t* r, packet_t* pkt);
+void process_sack(rel_t* s, uint32_t ackno, const uint8_t* bitmap, uint16_t len);
+void send_caps(rel_t* r, uint8_t flags);
+void send_caps_if_needed(rel_t* r);
+void protect_packet(rel_t* s, packet_t* packet);
+void send_parity(rel_t* s);
+void absorb_packet(rel_t* r, packet_t* pkt);
+void repair_packet(rel_t* r, const uint8_t* value, uint16_t len);
+bool ext_enabled(rel_t* r, uint32_t cap);
 long currentTimeMillis();
 
+#define PACE_INITIAL_BURST 10   /* Packets sent back to back before the first RTT sample when pacing */
+#define INPUT_STAGING 65536     /* Size of the block of input read at once */
+#define FEC_OVERHEAD (EXT_OPT_HEADER_LEN + FEC_HEADER_LEN)   /* Bytes a parity packet adds to the longest payload */
+#define TLP_MIN_PTO 10          /* Shortest wait for an acknowledgement before a tail loss probe (ms) */
+#define STREAM_HEADER_LEN 6     /* Stream number and stream sequence number in front of the payload (--streams) */
+#define FRAME_HEADER_LEN 4      /* Stream number and length in front of a frame of input or output (--streams) */
+
+/* Transfer statistics of a connection, printed on rel_destroy with --stats */
+typedef struct rel_stats {
+    unsigned long data_sent;            /* Data packets sent for the first time */
+    unsigned long bytes_sent;           /* Payload bytes of those */
+    unsigned long retransmits;          /* Data packets sent again */
+    unsigned long fast_retransmits;     /* Of those, sent on the third duplicate acknowledgement */
+    unsigned long tail_probes;          /* Of those, sent as tail loss probes (--tlp) */
+    unsigned long probe_recoveries;     /* Fast retransmits sent on a duplicate acknowledgement of a probe */
+    unsigned long bytes_retransmitted;  /* Payload bytes of those */
+    unsigned long sacked;               /* Packets in flight reported received by a SACK */
+    unsigned long acks_sent;            /* Acknowledgements sent without a SACK option */
+    unsigned long sacks_sent;           /* Acknowledgements sent with a SACK option */
+    unsigned long delack_timeouts;      /* Of those, sent when the delayed-ACK timer ran out (--delack) */
+    unsigned long pace_waits;           /* Times the pacer held back a packet */
+    unsigned long delivered_direct;     /* In-order data packets written straight from the datagram */
+    unsigned long delivered_buffered;   /* Data packets written from the receive buffer */
+    unsigned long delivered_ahead;      /* Of those, written before a missing packet of another stream (--streams) */
+    unsigned long input_reads;          /* conn_input calls that returned data */
+    unsigned long short_sent;           /* Data packets sent for the first time with less than a full payload */
+    unsigned long nagle_holds;          /* Times a short packet was held back (--nagle) */
+    unsigned long nagle_flushes;        /* Of those, sent when the hold time ran out */
+    unsigned long zero_windows;         /* Times the peer closed its receive window (--rwnd) */
+    unsigned long window_probes;        /* Window probes sent while it was closed */
+    unsigned long window_updates;       /* Acknowledgements sent because our own window reopened */
+    unsigned long parity_sent;          /* Parity packets sent (--fec) */
+    unsigned long repaired;             /* Lost data packets rebuilt from a parity packet */
+    long first_send;                    /* When the first data packet was sent (ms), -1 before */
+    long last_send;                     /* When the last data packet was sent or resent (ms) */
+} rel_stats_t;
+
 struct reliable_state {
     rel_t* next;			/* Linked list for traversing all connections */
     rel_t** prev;
@@ -40,6 +119,7 @@ struct reliable_state {
     /* Add your own data fields below this */
     buffer_t* send_buffer;
     buffer_t* rec_buffer;
+    pool_t* pool;           /* Buffer nodes and scratch packets, sized for both full windows */
 
     /* ----------------------------SENDER----------------------------
 
@@ -48,12 +128,60 @@ struct reliable_state {
     SND.NXT:            represents sequence number of the next byte that the sender will send
     MAXWND:         The size of sending window can vary, and it should not exceed a maximum value SND.WND <= SND.MAXWND where SND.WND = SND.NXT - SND.UNA
     TIME_OUT:           If a frme is not acknowledged within a certain time period (timeout) the sender will resend the frame
+                        The timeout starts at -t and then follows the measured round-trip time (see rtt.h)
+    Sequence numbers wrap around and are only compared with the serial number arithmetic of seq.h.
     -> see PDF page 19*/
 
-    int SND_UNA;
-    int SND_NXT;
+    uint32_t SND_UNA;
+    uint32_t SND_NXT;
     int MAXWND;
-    int timeout;
+    cc_t cc;            /* Congestion control, the effective window is min(cwnd, MAXWND) */
+    rtt_t rtt;
+    long armed_rto;     /* Largest timeout a retransmission timer in flight was armed with */
+    int dupacks;        /* Duplicate acknowledgements of SND_UNA received in a row */
+    uint32_t timed_out_at;  /* SND_NXT at the last retransmission timeout: packets before it were sent before that */
+    uint32_t resend_next;   /* Next packet of that flight to resend from SND_UNA on, as the send window opens */
+
+    /* Receive window of the peer (--rwnd, see ext.h): no more than peer_rwnd packets from SND_UNA are sent. While it
+    is 0, retransmissions are suspended and persist_timer sends window probes instead, backing off like the RTO. */
+    int peer_rwnd;          /* -1 until the peer advertises a window */
+    long persist_ivl;       /* Current interval between window probes (ms) */
+    tw_timer_t persist_timer;
+
+    /* Tail loss probe (--tlp): while packets are in flight, tlp_timer runs two SRTTs after the last new packet or
+    acknowledgement of new data. Should it expire before the RTO, the newest packet in flight is resent: if it was lost,
+    that repairs it, else the peer answers with a duplicate ACK, which fast-retransmits the oldest one right away. */
+    int tlp;
+    int tlp_state;          /* 0: may probe, 1: probe sent, 2: no more probes until new data is acknowledged */
+    tw_timer_t tlp_timer;
+
+    /* Pacing (--pace): new packets go out at a rate of one window per smoothed RTT instead of back to back.
+    Sending earns credit at that rate (at most one millisecond's worth is saved up), each packet spends one. */
+    int pacing;
+    double pace_credit;     /* Packets that may be sent right now */
+    long pace_last;         /* When the credit was last topped up (ms) */
+    tw_timer_t pace_timer;  /* Pending while packets wait for credit, resumes rel_read */
+
+    /* Input is read a block at a time into a staging buffer (allocated on the first read, freed once EOF is reached)
+    and sliced into packets, instead of one conn_input per packet. Bytes [in_off, in_len) are read but not yet sent. */
+    char* in_buf;
+    size_t in_off;
+    size_t in_len;
+    int in_eof;             /* conn_input reported EOF or an error */
+
+    /* Streams (--streams n): the input is a sequence of frames (see rlib.h), each packet carries bytes of one frame
+    behind a header with the stream number and the stream's own sequence number, which counts its packets. */
+    int streams;            /* Number of streams, 0 if off */
+    uint32_t* stream_out;   /* Sequence number of the next packet of each stream */
+    int frame_stream;       /* Stream of the frame being sent */
+    size_t frame_left;      /* Bytes of it not yet sent */
+
+    /* Nagle (--nagle ms): while a short data packet is unacknowledged, further short packets are held back so that
+    small writes coalesce in the staging buffer, for at most nagle ms (nagle_timer). */
+    int nagle;              /* Hold time in ms, 0 if off */
+    uint32_t nagle_seqno;   /* Sequence number of the unacknowledged short packet, 0 if none */
+    int nagle_force;        /* The hold time ran out: send what is staged */
+    tw_timer_t nagle_timer; /* Pending while a short packet is held back */
 
     /* ----------------------------RECEIVER----------------------------
     we need the following information:
@@ -71,26 +199,63 @@ struct reliable_state {
     send back ACK with cumulative ackno = RCV.NXT
     -> see PDF page 25*/
 
-    int RCV_NXT;
+    uint32_t RCV_NXT;
     int RCV_WND;
 
+    /* Delayed ACKs (--delack ms): an in-order packet is acknowledged together with the next one, or after delack
+    ms (delack_timer), whichever comes first. Anything else is acknowledged right away. */
+    int delack;             /* Delay in ms, 0 if off */
+    int ack_pending;        /* In-order packets received since the last acknowledgement */
+    tw_timer_t delack_timer;
+    int outbuf;             /* conn_bufspace when no output is queued */
+    int rwnd_adv;           /* Receive window last advertised (--rwnd), -1 before */
+
+    /* With --streams, a buffered packet is written out as soon as the packets of its own stream before it are, and
+    stays in the buffer (marked delivered) until RCV_NXT passes it. */
+    uint32_t* stream_in;    /* Stream sequence number of the next packet to write out of each stream */
+
     /* ----------------------------ERROR_FLAGS----------------------------
     We need to keep track of the end of files*/
 
     int EOF_SENT;
     int EOF_RECV;
     int EOF_ACK_RECV;
-    int EOF_seqno;
+    uint32_t EOF_seqno;
     int flushing;
+    tw_timer_t linger;  /* Pending while a finished connection still answers retransmissions of the peer's EOF */
+
+    /* ----------------------------EXTENSIONS----------------------------
+    Optional extensions, negotiated with the peer in control packets (see ext.h)*/
+
+    uint32_t caps;          /* Extensions enabled locally (EXT_CAP_*) */
+    uint32_t peer_caps;     /* Extensions announced by the peer */
+    int mss;                /* Largest payload we take (--mss, within the path MTU), see payload_size */
+    int peer_mss;           /* Largest payload the peer takes (EXT_OPT_MSS), 0 until announced */
+    int caps_sent;          /* How often our capabilities were sent without confirmation */
+    long caps_time;         /* When they were last sent */
+    int caps_acked;         /* The peer confirmed receiving our capabilities */
+
+    /* Forward error correction (--fec k, see fec.h): every group of k new data packets is followed by its parity, and
+    the peer's groups are added up as they arrive so that one lost packet per group can be rebuilt. */
+    int fec;                /* Our group size, 0 if off */
+    int peer_fec;           /* The peer's group size (EXT_OPT_FEC), 0 until announced */
+    fec_t* fec_out;         /* Group being sent, allocated once FEC is used */
+    fec_t* fec_in;          /* Groups being received, likewise */
+
+    rel_stats_t stats;
+    int print_stats;
 
-}; rel_t* rel_list;
+}; THREAD_LOCAL rel_t* rel_list;
+
+/* Retransmission timers of all packets in flight, on all connections */
+THREAD_LOCAL timer_wheel_t rel_timers;
 
 
 
 /**
- * Creates a new reliable protocol session, returns NULL on failure, ss is always NULL
- * @param   c       connection
- * @param   ss      const struct sockaddr_storage*, which is always NULL
+ * Creates a new reliable protocol session, returns NULL on failure
+ * @param   c       connection, NULL in server mode (a new peer sent its first packet)
+ * @param   ss      const struct sockaddr_storage*, address of the new peer in server mode, NULL otherwise
  * @param   cc      const struct config_common* cc
  * @return  rel_t*  the reliable state
  */
@@ -109,6 +274,9 @@ rel_t* rel_create(conn_t* c, const struct sockaddr_storage* ss, const struct con
     }
 
     r->c = c;
+    if (rel_timers.count == 0) {
+        timer_wheel_init(&rel_timers, currentTimeMillis());
+    }
     /*sets the next field to the current head of the linked list of all reliable protocol sessions */
     r->next = rel_list;
     /*This line sets the prev field of the reliable protocol session r to the memory address of the rel_list pointer.
@@ -119,20 +287,73 @@ rel_t* rel_create(conn_t* c, const struct sockaddr_storage* ss, const struct con
         rel_list->prev = &r->next;
     rel_list = r;
 
-    /*memory*/
+    /*largest payload: IPv4 and UDP headers take 28 bytes of the path MTU, ours 12*/
+    int mtu = conn_mtu(c);
+    r->mss = cc->mss;
+    if (mtu > 0 && mtu - 40 < r->mss) {
+        r->mss = mtu - 40 > PACKET_DATA_DEFAULT ? mtu - 40 : PACKET_DATA_DEFAULT;
+    }
+
+    /*memory: one node per packet of both windows, plus one scratch packet for rel_read and one for ACKs, each with
+    room for the largest payload only*/
+    r->pool = xmalloc(sizeof(pool_t));
+    size_t nodes = 2 * (size_t)cc->window + 2;
+    pool_init(r->pool, BUFFER_NODE_SIZE(r->mss), nodes < UINT32_MAX ? nodes : UINT32_MAX);
     r->send_buffer = xmalloc(sizeof(buffer_t));
-    r->send_buffer->head = NULL;
+    buffer_init(r->send_buffer, cc->window, r->pool);
     r->rec_buffer = xmalloc(sizeof(buffer_t));
-    r->rec_buffer->head = NULL;
+    buffer_init(r->rec_buffer, cc->window, r->pool);
 
     /*sender*/
-    r->SND_UNA = 1;
-    r->SND_NXT = 1;
+    r->SND_UNA = cc->isn;
+    r->SND_NXT = cc->isn;
+    r->timed_out_at = cc->isn;
+    r->resend_next = cc->isn;
     r->MAXWND = cc->window;
-    r->timeout = cc->timeout;
+    rtt_init(&r->rtt, cc->timeout, cc->rto_min, cc->rto_max);
+    cc_init(&r->cc, cc_find(cc->cc_algorithm), cc->window);
+    r->cc.recover = cc->isn;    // A serial number: the initial 0 could lie ahead of the first packets
+    r->pacing = cc->pace;
+    tw_timer_init(&r->pace_timer, pace_resume, r);
+    r->peer_rwnd = -1;
+    tw_timer_init(&r->persist_timer, persist_probe, r);
+    r->tlp = cc->tlp;
+    tw_timer_init(&r->tlp_timer, tail_probe, r);
+    r->nagle = cc->nagle;
+    tw_timer_init(&r->nagle_timer, nagle_flush, r);
+    r->streams = cc->streams;
+    if (r->streams) {
+        r->stream_out = xmalloc(r->streams * sizeof(uint32_t));
+        memset(r->stream_out, 0, r->streams * sizeof(uint32_t));
+        r->stream_in = xmalloc(r->streams * sizeof(uint32_t));
+        memset(r->stream_in, 0, r->streams * sizeof(uint32_t));
+    }
+    tw_timer_init(&r->linger, linger_expired, r);
 
     /*receiver*/
-    r->RCV_NXT = 1;
+    r->RCV_NXT = cc->isn;
+    // With a window of 1 the second packet of a pair never comes before the acknowledgement of the first
+    r->delack = cc->window > 1 ? cc->delack : 0;
+    tw_timer_init(&r->delack_timer, delack_expired, r);
+    r->outbuf = cc->outbuf;
+    r->rwnd_adv = -1;
+
+    /*extensions*/
+    if (cc->sack) {
+        r->caps |= EXT_CAP_SACK;
+    }
+    if (cc->rwnd) {
+        r->caps |= EXT_CAP_RWND;
+    }
+    if (r->mss > PACKET_DATA_DEFAULT) {
+        r->caps |= EXT_CAP_MSS;
+    }
+    r->fec = cc->fec;
+    if (r->fec) {
+        r->caps |= EXT_CAP_FEC;
+    }
+    r->print_stats = cc->stats;
+    r->stats.first_send = -1;
 
     return r;
 }
@@ -148,12 +369,75 @@ void rel_destroy(rel_t* r) {
     }
     *r->prev = r->next;
     conn_destroy(r->c);
+    tw_timer_del(&r->linger);
+    tw_timer_del(&r->pace_timer);
+    tw_timer_del(&r->nagle_timer);
+    tw_timer_del(&r->delack_timer);
+    tw_timer_del(&r->persist_timer);
+    tw_timer_del(&r->tlp_timer);
 
-    buffer_clear(r->send_buffer);
+    buffer_destroy(r->send_buffer);
     free(r->send_buffer);
 
-    buffer_clear(r->rec_buffer);
+    buffer_destroy(r->rec_buffer);
     free(r->rec_buffer);
+
+    if (opt_debug) {
+        fprintf(stderr, "[pool: %u blocks, %lu heap allocations]\n", r->pool->capacity, r->pool->heap_allocs);
+    }
+    if (r->print_stats || opt_debug) {
+        fprintf(stderr, "[stats: sent %lu packets (%lu bytes), retransmitted %lu packets (%lu bytes), "
+                "fast %lu, sacked %lu, acks %lu, sacks %lu, delayed acks timed out %lu, sack %s, cc %s cwnd %u]\n",
+                r->stats.data_sent, r->stats.bytes_sent, r->stats.retransmits, r->stats.bytes_retransmitted,
+                r->stats.fast_retransmits, r->stats.sacked, r->stats.acks_sent, r->stats.sacks_sent,
+                r->stats.delack_timeouts,
+                ext_enabled(r, EXT_CAP_SACK) ? "on" : "off", r->cc.ops->name, cc_window(&r->cc));
+        if (r->stats.delivered_direct || r->stats.delivered_buffered) {
+            fprintf(stderr, "[recv: %lu packets delivered directly, %lu from the receive buffer, %lu of those ahead of "
+                    "a missing packet of another stream]\n",
+                    r->stats.delivered_direct, r->stats.delivered_buffered, r->stats.delivered_ahead);
+        }
+        if (r->tlp) {
+            fprintf(stderr, "[tlp: %lu tail loss probes, %lu fast retransmits on a duplicate acknowledgement of "
+                    "one]\n", r->stats.tail_probes, r->stats.probe_recoveries);
+        }
+        if (ext_enabled(r, EXT_CAP_RWND)) {
+            fprintf(stderr, "[rwnd: peer closed its window %lu times, %lu probes; %lu window updates sent]\n",
+                    r->stats.zero_windows, r->stats.window_probes, r->stats.window_updates);
+        }
+        if (r->fec_out || r->fec_in) {
+            fprintf(stderr, "[fec: %lu parity packets sent for groups of %d, %lu lost packets rebuilt]\n",
+                    r->stats.parity_sent, r->fec, r->stats.repaired);
+        }
+        if (r->stats.input_reads) {
+            fprintf(stderr, "[input: %lu reads for %lu packets]\n", r->stats.input_reads, r->stats.data_sent);
+        }
+        if (r->stats.data_sent) {
+            fprintf(stderr, "[efficiency: %.1f payload bytes per packet (up to %d), %.1f%% of data packet bytes are "
+                    "payload, %lu short packets, nagle %s: %lu held, %lu flushed by timer]\n",
+                    (double)r->stats.bytes_sent / r->stats.data_sent, payload_size(r),
+                    100.0 * r->stats.bytes_sent / (r->stats.bytes_sent + 12.0 * r->stats.data_sent),
+                    r->stats.short_sent, r->nagle ? "on" : "off", r->stats.nagle_holds, r->stats.nagle_flushes);
+        }
+        if (r->stats.last_send > r->stats.first_send && r->stats.first_send >= 0) {
+            fprintf(stderr, "[rate: %.1f kB/s over %ld ms, paced %s, %lu waits]\n",
+                    (double)(r->stats.bytes_sent + r->stats.bytes_retransmitted) / (r->stats.last_send - r->stats.first_send),
+                    r->stats.last_send - r->stats.first_send, r->pacing ? "on" : "off", r->stats.pace_waits);
+        }
+    }
+    if (r->fec_out) {
+        fec_destroy(r->fec_out);
+        free(r->fec_out);
+    }
+    if (r->fec_in) {
+        fec_destroy(r->fec_in);
+        free(r->fec_in);
+    }
+    pool_destroy(r->pool);
+    free(r->pool);
+    free(r->in_buf);
+    free(r->stream_out);
+    free(r->stream_in);
 }
 
 
@@ -168,77 +452,247 @@ void rel_destroy(rel_t* r) {
 void rel_recvpkt(rel_t* r, packet_t* pkt, size_t n) {
     uint16_t len = ntohs(pkt->len);
     uint16_t cksum_old = ntohs(pkt->cksum);
-    uint16_t seqno = ntohl(pkt->seqno);
+    uint32_t seqno = ntohl(pkt->seqno);
 
     pkt->cksum = 0;
 
-    // Verify packet checksum and length -> check if corrupted
-    if (len != n || cksum_old != ntohs(cksum(pkt, len))) {
+    // Verify packet checksum and length -> check if corrupted (or larger than what we agreed to take)
+    if (len != n || len > 12 + r->mss || cksum_old != ntohs(cksum(pkt, len))) {
         return;
     }
 
-    if (is_ACK(pkt) && pkt->ackno == r->EOF_seqno + 1) {
-        r->EOF_ACK_RECV = 1;
-    }
-
-    if (isDone(r)) {
-        rel_destroy(r);
-        return;
+    // Control packets carry an acknowledgement plus extension options
+    if (ext_is_control(pkt)) {
+        process_control(r, pkt);
+        finish_if_done(r);
     }
     // If the packet is an ACK, remove it from the send buffer and update the SND_UNA variable
-    if (is_ACK(pkt)) {
-        buffer_remove(r->send_buffer, ntohl(pkt->ackno));
-        r->SND_UNA = MAX(ntohl(pkt->ackno), r->SND_UNA);
-        rel_read(r);
+    else if (is_ACK(pkt)) {
+        process_ack(r, ntohl(pkt->ackno), true);
+        finish_if_done(r);
     }
     // If the packet is not an ACK and the sequence number is less than RCV_NXT, send an ACK
-    else if (seqno < r->RCV_NXT) {
+    else if (seq_lt(seqno, r->RCV_NXT)) {
         if (seqno != 0) {
             create_send_ack(r);
         }
     }
+    // In order with nothing buffered in its place: write the payload straight from the datagram, without a copy
+    // (with --streams it takes a frame header, which stream_output puts in front of buffered packets)
+    else if (seqno == r->RCV_NXT && !is_EOF(pkt) && !r->streams && conn_bufspace(r->c) >= len - 12
+             && !buffer_contains(r->rec_buffer, r->RCV_NXT)) {
+        uint32_t rcv_nxt;
+        absorb_packet(r, pkt);
+        r->flushing = 1;
+        conn_output(r->c, pkt->data, len - 12);
+        r->RCV_NXT = seq_next(r->RCV_NXT);
+        r->flushing = 0;
+        r->stats.delivered_direct++;
+        // Packets buffered behind it may be in order now; rel_output acknowledges those, else acknowledge this one
+        // (possibly together with the next one, see delay_ack)
+        rcv_nxt = r->RCV_NXT;
+        rel_output(r);
+        if (r->RCV_NXT == rcv_nxt && len - 12 >= payload_size(r)) {
+            delay_ack(r);
+        }
+        // A short packet means the sender ran out of input for now and may be waiting for this (see nagle_holds)
+        else if (r->RCV_NXT == rcv_nxt) {
+            create_send_ack(r);
+        }
+    }
     // If the packet is not an ACK and the sequence number is within the receive window, buffer and output the packet
-    else if (seqno < r->RCV_NXT + r->MAXWND && conn_bufspace(r->c) >= len - 12) {
-        if (!buffer_contains(r->rec_buffer, ntohl(pkt->seqno))) {
+    else if (seq_lt(seqno, r->RCV_NXT + r->MAXWND) && conn_bufspace(r->c) >= len - 12) {
+        if (!buffer_contains(r->rec_buffer, seqno)) {
             buffer_insert(r->rec_buffer, pkt, currentTimeMillis());
+            absorb_packet(r, pkt);
         }
         rel_output(r);
+        // Out of order: acknowledge anyway, so that the sender learns about the hole (and with SACK, what is buffered)
+        if (seq_gt(seqno, r->RCV_NXT)) {
+            create_send_ack(r);
+        }
+    }
+    // Dropped for lack of output space: tell a sender that knows about receive windows what ours is
+    else if (ext_enabled(r, EXT_CAP_RWND)) {
+        create_send_ack(r);
     }
 }
+/* Most in-order packets handed to conn_outputv at once */
+#define OUTPUT_BATCH 32
+
 /**
 * Outputs the received packets in the receive buffer.
+* Consecutive in-order data packets that fit into the output buffer are written with a single conn_outputv call and
+* acknowledged with a single (cumulative) ACK.
 * @param r rel_t* the reliable state
 * @return void
 */
 void rel_output(rel_t* r) {
+    if (r->streams) {
+        stream_output(r);
+        return;
+    }
+    struct iovec iov[OUTPUT_BATCH];
     buffer_node_t* first_node = buffer_get_first(r->rec_buffer);
-    if (!first_node) return;
-    packet_t* pkt = &(first_node->packet);
+    packet_t* pkt = first_node ? &(first_node->packet) : NULL;
     // Iterate through the receive buffer and output packets
-    while (first_node && ntohl(pkt->seqno) == (uint32_t)r->RCV_NXT && enough_space(r, pkt)) {
+    while (first_node && ntohl(pkt->seqno) == r->RCV_NXT && enough_space(r, pkt)) {
         if (is_EOF(pkt)) {
             conn_output(r->c, pkt->data, htons(0));
             buffer_remove_first(r->rec_buffer);
-            r->RCV_NXT++;
+            r->RCV_NXT = seq_next(r->RCV_NXT);
             r->EOF_RECV = 1;
             create_send_ack(r);
-            if (isDone(r)) {
-                rel_destroy(r);
-                return;
-            }
+            finish_if_done(r);
         }
-        // If there is enough buffer space, output the packet
-        else if (conn_bufspace(r->c) >= ntohs(pkt->len) - 12) {
+        // Gather the run of in-order data packets that fits into the output buffer, the first one always does
+        else {
+            size_t space = conn_bufspace(r->c);
+            buffer_node_t* node = first_node;
+            uint32_t next = r->RCV_NXT;
+            int n = 0;
+            while (node && n < OUTPUT_BATCH && ntohl(node->packet.seqno) == next
+                   && !is_EOF(&node->packet) && space >= (size_t)ntohs(node->packet.len) - 12) {
+                iov[n].iov_base = node->packet.data;
+                iov[n].iov_len = ntohs(node->packet.len) - 12;
+                space -= iov[n].iov_len;
+                n++;
+                next = seq_next(next);
+                node = buffer_next(r->rec_buffer, node);
+            }
             r->flushing = 1;
-            conn_output(r->c, pkt->data, ntohs(pkt->len) - 12);
-            buffer_remove_first(r->rec_buffer);
-            r->RCV_NXT++;
+            conn_outputv(r->c, iov, n);
+            buffer_remove(r->rec_buffer, next);
+            r->RCV_NXT = next;
+            r->stats.delivered_buffered += n;
             r->flushing = 0;
             create_send_ack(r);
         }
         first_node = buffer_get_first(r->rec_buffer);
         if (first_node) pkt = &(first_node->packet);
     }
+    window_update(r);
+}
+
+/**
+ * with --streams: write out every buffered packet whose stream is in order up to it, as a frame, whatever is still
+ * missing on other streams before it; then move RCV_NXT past the packets written out and acknowledge them
+ * packets of a stream come in the order of their sequence numbers, so one pass catches all that became in order
+ * @param   rel_t *
+ * @return  void
+ */
+void stream_output(rel_t* r) {
+    struct iovec iov[OUTPUT_BATCH];
+    uint8_t frames[OUTPUT_BATCH / 2][FRAME_HEADER_LEN];
+    size_t space = conn_bufspace(r->c);
+    uint32_t rcv_nxt = r->RCV_NXT;
+    buffer_node_t* node;
+    int n = 0;
+
+    for (node = buffer_get_first(r->rec_buffer); node; node = buffer_next(r->rec_buffer, node)) {
+        packet_t* pkt = &node->packet;
+        uint16_t len = ntohs(pkt->len) - 12;
+        if (node->delivered || is_EOF(pkt)) {
+            continue;
+        }
+        const uint8_t* header = (const uint8_t*)pkt->data;
+        uint16_t stream = header[0] << 8 | header[1];
+        uint32_t ssn = (uint32_t)header[2] << 24 | header[3] << 16 | header[4] << 8 | header[5];
+        // A packet without a valid stream header carries nothing that could be written out
+        if (len < STREAM_HEADER_LEN || stream >= r->streams) {
+            node->delivered = 1;
+            continue;
+        }
+        len -= STREAM_HEADER_LEN;
+        if (ssn != r->stream_in[stream]) {
+            continue;
+        }
+        if (space < (size_t)FRAME_HEADER_LEN + len) {
+            break;
+        }
+        uint8_t* frame = frames[n / 2];
+        frame[0] = stream >> 8;
+        frame[1] = stream;
+        frame[2] = len >> 8;
+        frame[3] = len;
+        iov[n].iov_base = frame;
+        iov[n].iov_len = FRAME_HEADER_LEN;
+        iov[n + 1].iov_base = pkt->data + STREAM_HEADER_LEN;
+        iov[n + 1].iov_len = len;
+        n += 2;
+        space -= FRAME_HEADER_LEN + len;
+        r->stream_in[stream]++;
+        node->delivered = 1;
+        r->stats.delivered_buffered++;
+        if (seq_gt(ntohl(pkt->seqno), r->RCV_NXT)) {
+            r->stats.delivered_ahead++;
+        }
+        if (n == OUTPUT_BATCH) {
+            r->flushing = 1;
+            conn_outputv(r->c, iov, n);
+            r->flushing = 0;
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        r->flushing = 1;
+        conn_outputv(r->c, iov, n);
+        r->flushing = 0;
+    }
+
+    while ((node = buffer_get_first(r->rec_buffer)) && ntohl(node->packet.seqno) == r->RCV_NXT) {
+        // Everything before the EOF has been written out once RCV_NXT reaches it
+        if (is_EOF(&node->packet)) {
+            conn_output(r->c, node->packet.data, 0);
+            buffer_remove_first(r->rec_buffer);
+            r->RCV_NXT = seq_next(r->RCV_NXT);
+            r->EOF_RECV = 1;
+            create_send_ack(r);
+            finish_if_done(r);
+            break;
+        }
+        if (!node->delivered) {
+            break;
+        }
+        buffer_remove_first(r->rec_buffer);
+        r->RCV_NXT = seq_next(r->RCV_NXT);
+    }
+    if (r->RCV_NXT != rcv_nxt && !r->EOF_RECV) {
+        create_send_ack(r);
+    }
+    window_update(r);
+}
+
+/**
+ * our receive window (--rwnd): the whole window while output keeps up, else the packets the free output space takes
+ * @param   rel_t *
+ * @return  int     packets from RCV_NXT
+ */
+int recv_window(rel_t* r) {
+    size_t space = conn_bufspace(r->c);
+    if (space >= (size_t)r->outbuf) {
+        return r->MAXWND;
+    }
+    size_t packets = space / payload_size(r);
+    return packets < (size_t)r->MAXWND ? (int)packets : r->MAXWND;
+}
+
+/**
+ * tell the peer that our receive window has reopened (--rwnd): from 0, or to at least twice what was last advertised;
+ * the library calls rel_output whenever output drains, which is when this happens
+ * @param   rel_t *
+ * @return  void
+ */
+void window_update(rel_t* r) {
+    int rwnd;
+    if (!ext_enabled(r, EXT_CAP_RWND) || r->rwnd_adv < 0 || r->EOF_RECV) {
+        return;
+    }
+    rwnd = recv_window(r);
+    if (rwnd > r->rwnd_adv && (r->rwnd_adv == 0 || rwnd >= 2 * r->rwnd_adv)) {
+        r->stats.window_updates++;
+        create_send_ack(r);
+    }
 }
 
 
@@ -252,18 +706,21 @@ void rel_read(rel_t* s) {
     if ((s->EOF_SENT)) {
         return;
     }
+    send_caps_if_needed(s);
     // Keep sending packets while there is data to be read and packets to be sent
     while (should_send_packet(s)) {
-        packet_t* packet = (packet_t*)xmalloc(512);
-        memset(packet, 0, sizeof(packet_t));
-        int read_byte = conn_input(s -> c, packet->data, 500);
-        int SND_NXT = s->SND_NXT;
-
-        // If there is no more data to read, break out of the loop
-        if (read_byte == 0) {
-            free(packet);
+        int avail = input_fill(s);
+
+        // If there is no more data to read, or only a short packet that has to wait, break out of the loop
+        if (avail == 0 || nagle_holds(s, avail) || !pace_allows(s)) {
             break;
         }
+        buffer_node_t* scratch = pool_get(s->pool);
+        packet_t* packet = &scratch->packet;
+        memset(packet, 0, offsetof(packet_t, data));
+        int read_byte = input_take(s, packet->data);
+        uint32_t SND_NXT = s->SND_NXT;
+
         // If there was an error while reading, send an EOF packet and mark it as sent
         if (read_byte == -1) {
             s->EOF_SENT = 1;
@@ -273,40 +730,156 @@ void rel_read(rel_t* s) {
         else {
             // Otherwise, create a packet with the data read and send it
             create_packet(packet, 12 + read_byte, SND_NXT, 0, 1);
+            if (read_byte < payload_size(s)) {
+                s->nagle_seqno = SND_NXT;
+                s->stats.short_sent++;
+                tw_timer_del(&s->nagle_timer);
+            }
         }
 
-        s->SND_NXT++;
+        s->SND_NXT = seq_next(s->SND_NXT);
         send_packet(packet, s);
-        free(packet);
+        protect_packet(s, packet);
+        pool_put(s->pool, scratch);
+    }
+}
+/**
+ * Refill the staging buffer with one conn_input call once less than a full packet is left in it, so that full
+ * packets are sent whenever the input has the bytes for them.
+ * @param   s       rel_t *
+ * @return  int     number of bytes staged, 0 if no input is available right now, -1 once all input up to EOF is taken
+ */
+int input_fill(rel_t* s) {
+    size_t avail = s->in_len - s->in_off;
+
+    if (avail < (size_t)payload_size(s) && !s->in_eof) {
+        if (!s->in_buf) {
+            s->in_buf = xmalloc(INPUT_STAGING);
+        }
+        // Keep the leftover in front of the new block
+        memmove(s->in_buf, s->in_buf + s->in_off, avail);
+        s->in_off = 0;
+        s->in_len = avail;
+        int n = conn_input(s->c, s->in_buf + s->in_len, INPUT_STAGING - s->in_len);
+        if (n < 0) {
+            s->in_eof = 1;
+        }
+        else if (n > 0) {
+            s->in_len += n;
+            s->stats.input_reads++;
+        }
+        avail = s->in_len - s->in_off;
+    }
+    if (avail == 0 && s->in_eof) {
+        free(s->in_buf);
+        s->in_buf = NULL;
+        return -1;
+    }
+    if (s->streams && avail > 0) {
+        return stream_fill(s);
+    }
+    return avail;
+}
+
+/**
+ * with --streams: start the next frame of the staged input once the current one is sent (see input_fill)
+ * input that is no sequence of frames for our streams ends it, like an error reading it
+ * @param   s       rel_t *
+ * @return  int     payload of the next packet staged, stream header included, 0 if none right now, -1 at EOF
+ */
+int stream_fill(rel_t* s) {
+    size_t avail = s->in_len - s->in_off;
+
+    // Empty frames carry nothing to send
+    while (s->frame_left == 0 && avail >= FRAME_HEADER_LEN) {
+        const uint8_t* frame = (const uint8_t*)s->in_buf + s->in_off;
+        s->frame_stream = frame[0] << 8 | frame[1];
+        s->frame_left = frame[2] << 8 | frame[3];
+        s->in_off += FRAME_HEADER_LEN;
+        avail -= FRAME_HEADER_LEN;
+        if (s->frame_stream >= s->streams) {
+            fprintf(stderr, "[input: frame for stream %d of %d, ignoring the rest]\n", s->frame_stream, s->streams);
+            s->in_eof = 1;
+            s->in_off = s->in_len;
+            s->frame_left = 0;
+            return input_fill(s);
+        }
+    }
+    // Part of a frame header can only be completed by more input
+    if (s->frame_left == 0 && s->in_eof) {
+        s->in_off = s->in_len;
+        return input_fill(s);
     }
+    if (s->frame_left == 0 || avail == 0) {
+        return 0;
+    }
+    return STREAM_HEADER_LEN + (avail < s->frame_left ? avail : s->frame_left);
 }
+
+/**
+ * Take the payload of the next data packet from the staging buffer (see input_fill).
+ * @param   s       rel_t *
+ * @param   data    char *, where to put the payload (payload_size bytes)
+ * @return  int     number of bytes put there (with --streams, including the stream header), -1 once all input up to
+ *                  EOF is taken
+ */
+int input_take(rel_t* s, char* data) {
+    size_t avail = s->in_len - s->in_off;
+
+    if (avail == 0 && s->in_eof) {
+        return -1;
+    }
+    // With --streams, a packet holds bytes of one frame only (see stream_fill)
+    if (s->streams) {
+        uint32_t ssn = s->stream_out[s->frame_stream]++;
+        uint8_t* header = (uint8_t*)data;
+        if (avail > s->frame_left) {
+            avail = s->frame_left;
+        }
+        if (avail > (size_t)payload_size(s) - STREAM_HEADER_LEN) {
+            avail = payload_size(s) - STREAM_HEADER_LEN;
+        }
+        header[0] = s->frame_stream >> 8;
+        header[1] = s->frame_stream;
+        header[2] = ssn >> 24;
+        header[3] = ssn >> 16;
+        header[4] = ssn >> 8;
+        header[5] = ssn;
+        memcpy(data + STREAM_HEADER_LEN, s->in_buf + s->in_off, avail);
+        s->in_off += avail;
+        s->frame_left -= avail;
+        return STREAM_HEADER_LEN + avail;
+    }
+    if (avail > (size_t)payload_size(s)) {
+        avail = payload_size(s);
+    }
+    memcpy(data, s->in_buf + s->in_off, avail);
+    s->in_off += avail;
+    return avail;
+}
+
 /**
  * rel_timer - Function to handle retransmissions for all active connections
+ * Only the retransmission timers that have expired are run (see retransmit_packet).
  * @param None
  * @return None
  */
 void rel_timer() {
-    rel_t* current = rel_list;
-    // Iterate through all the connections in the rel_list
-    while (current) {
-        buffer_node_t* node = buffer_get_first(current->send_buffer);
-        // Iterate through all the packets in the send_buffer of the current connection
-        while (node) {
-            // Check if the time since the last retransmit is greater than or equal to the timeout period
-            long cur_time = currentTimeMillis();
-            long last_time = node->last_retransmit;
-            long timeout = current->timeout;
-            if ((cur_time - last_time) >= timeout) {
-                // Retransmit the packet and update the last_retransmit time
-                conn_sendpkt(current->c, &(node->packet), (size_t)ntohs(node->packet.len));
-                node->last_retransmit = cur_time;
-            }
-            // Move on to the next packet in the buffer
-            node = node->next;
-        }
-        // Move on to the next connection in the rel_list
-        current = current->next;
+    timer_wheel_run(&rel_timers, currentTimeMillis());
+}
+
+/**
+ * rel_timer_in - Time until rel_timer has to run next
+ * @param None
+ * @return long milliseconds until the next retransmission is due (0 if overdue, -1 if nothing is in flight)
+ */
+long rel_timer_in() {
+    long next = timer_wheel_next(&rel_timers);
+    if (next < 0) {
+        return -1;
     }
+    long now = currentTimeMillis();
+    return next > now ? next - now : 0;
 }
 
 
@@ -317,15 +890,15 @@ void rel_timer() {
 
 /**
  * https//stackoverflow.com/questions/10098441/get-the-current-time-in-milliseconds-in-c
- * gets the current time
+ * gets the current time of the monotonic clock (not affected by changes of the wall clock)
  * @param None
  * @return long
  */
 long currentTimeMillis() {
-    struct timeval time;
-    gettimeofday(&time, NULL);
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
     int64_t s1 = (int64_t)(time.tv_sec) * 1000;
-    int64_t s2 = (time.tv_usec / 1000);
+    int64_t s2 = (time.tv_nsec / 1000000);
     return s1 + s2;
 }
 
@@ -338,13 +911,138 @@ bool isDone(rel_t* r) {
     return (r->EOF_SENT && r->EOF_RECV && r->EOF_ACK_RECV && !r->flushing && buffer_size(r->send_buffer) == 0);
 }
 
+/**
+ * destroy the connection once it is done, after lingering for a few timeouts:
+ * the peer may not have received our last acknowledgement and retransmit its EOF, which is acknowledged again
+ * @param   rel_t *
+ * @return  void
+ */
+void finish_if_done(rel_t* r) {
+    if (isDone(r) && !tw_timer_pending(&r->linger)) {
+        tw_timer_add(&rel_timers, &r->linger, currentTimeMillis() + 3 * rtt_rto(&r->rtt));
+    }
+}
+
+/**
+ * linger timer callback: the connection is finished for good
+ * @param   tw_timer_t *
+ * @param   void *          the rel_t
+ * @return  void
+ */
+void linger_expired(tw_timer_t* timer, void* arg) {
+    rel_destroy(arg);
+}
+
 /**
  * function to check if the sender can send a packet
  * @param   rel_t *
  * @return  long
  */
 bool should_send_packet(rel_t* s) {
-    return (s->SND_NXT - s->SND_UNA < s->MAXWND) && (!(s->EOF_SENT));
+    int32_t in_flight = seq_diff(s->SND_NXT, s->SND_UNA);
+    return (in_flight < send_window(s)) && (!(s->EOF_SENT))
+           && (s->peer_rwnd < 0 || in_flight < s->peer_rwnd);
+}
+
+/**
+ * check whether the pacer lets the next new packet go out now; if not, arm the pacing timer for when it will
+ * without an RTT estimate yet, only the first PACE_INITIAL_BURST packets may go out (their ACKs give one)
+ * @param   rel_t *
+ * @return  bool
+ */
+bool pace_allows(rel_t* s) {
+    if (!s->pacing) {
+        return true;
+    }
+    if (!s->rtt.has_sample) {
+        return seq_diff(s->SND_NXT, s->SND_UNA) < PACE_INITIAL_BURST;
+    }
+    long now = currentTimeMillis();
+    double srtt = s->rtt.srtt8 / 8.0;
+    double rate = send_window(s) / (srtt > 1 ? srtt : 1);    // packets per ms
+    s->pace_credit += (now - s->pace_last) * rate;
+    if (s->pace_credit > (rate > 1 ? rate : 1)) {
+        s->pace_credit = rate > 1 ? rate : 1;
+    }
+    s->pace_last = now;
+    if (s->pace_credit >= 1) {
+        return true;
+    }
+    if (!tw_timer_pending(&s->pace_timer)) {
+        tw_timer_add(&rel_timers, &s->pace_timer, now + (long)ceil((1 - s->pace_credit) / rate));
+        s->stats.pace_waits++;
+    }
+    return false;
+}
+
+/**
+ * check whether a short packet of avail bytes has to be held back (--nagle): another short one is unacknowledged, no
+ * EOF follows it and the hold time has not run out; if so, start the hold time
+ * @param   rel_t *
+ * @param   int             bytes staged (-1 at EOF)
+ * @return  bool
+ */
+bool nagle_holds(rel_t* s, int avail) {
+    if (!s->nagle || avail < 0 || avail >= payload_size(s) || s->in_eof || !s->nagle_seqno || s->nagle_force) {
+        return false;
+    }
+    if (!tw_timer_pending(&s->nagle_timer)) {
+        tw_timer_add(&rel_timers, &s->nagle_timer, currentTimeMillis() + s->nagle);
+        s->stats.nagle_holds++;
+    }
+    return true;
+}
+
+/**
+ * nagle timer callback: a short packet was held back long enough, send it
+ * @param   tw_timer_t *
+ * @param   void *          the rel_t
+ * @return  void
+ */
+void nagle_flush(tw_timer_t* timer, void* arg) {
+    rel_t* s = arg;
+    s->stats.nagle_flushes++;
+    s->nagle_force = 1;
+    rel_read(s);
+    s->nagle_force = 0;
+}
+
+/**
+ * pacing timer callback: enough credit has been earned to send again
+ * @param   tw_timer_t *
+ * @param   void *          the rel_t
+ * @return  void
+ */
+void pace_resume(tw_timer_t* timer, void* arg) {
+    rel_read(arg);
+}
+
+/**
+ * the number of packets that may be in flight: the congestion window, but never more than the configured window
+ * @param   rel_t *
+ * @return  int
+ */
+int send_window(rel_t* s) {
+    int cwnd = cc_window(&s->cc);
+    return cwnd < s->MAXWND ? cwnd : s->MAXWND;
+}
+
+/**
+ * the payload of a full data packet, in both directions: the smaller of both sides' --mss once the peer agreed to a
+ * larger one than the default (see EXT_OPT_MSS in ext.h), else the default; less the parity header with --fec
+ * @param   rel_t *
+ * @return  int     bytes
+ */
+int payload_size(rel_t* r) {
+    int size = PACKET_DATA_DEFAULT;
+    if (ext_enabled(r, EXT_CAP_MSS) && r->peer_mss >= PACKET_DATA_DEFAULT) {
+        size = r->mss < r->peer_mss ? r->mss : r->peer_mss;
+    }
+    // A parity packet carries the longest payload of its group plus a header, and must not exceed a data packet
+    if (ext_enabled(r, EXT_CAP_FEC)) {
+        size -= FEC_OVERHEAD;
+    }
+    return size;
 }
 
 /**
@@ -354,20 +1052,231 @@ bool should_send_packet(rel_t* s) {
  * @return  void
  */
 void send_packet(packet_t* packet, rel_t* s) {
-    buffer_insert(s->send_buffer, packet, currentTimeMillis());
+    long now = currentTimeMillis();
+    s->stats.data_sent++;
+    s->stats.bytes_sent += ntohs(packet->len) - 12;
+    if (s->stats.first_send < 0) {
+        s->stats.first_send = now;
+    }
+    s->stats.last_send = now;
+    if (s->pacing) {
+        s->pace_credit -= 1;
+    }
+    buffer_insert(s->send_buffer, packet, now);
+    buffer_node_t* node = buffer_get(s->send_buffer, ntohl(packet->seqno));
+    tw_timer_init(&node->timer, retransmit_packet, s);
+    arm_retransmit(s, node);
+    arm_tail_probe(s);
     conn_sendpkt(s->c, packet, (size_t)ntohs(packet->len));
 }
 
+/**
+ * (re)arm the retransmission timer of a packet in the send buffer, one timeout after its last transmission
+ * @param   rel_t *
+ * @param   buffer_node_t *     the buffer node of the packet
+ * @return  void
+ */
+void arm_retransmit(rel_t* s, buffer_node_t* node) {
+    long rto = rtt_rto(&s->rtt);
+    if (buffer_size(s->send_buffer) == 1) {
+        s->armed_rto = 0;
+    }
+    if (rto > s->armed_rto) {
+        s->armed_rto = rto;
+    }
+    tw_timer_add(&rel_timers, &node->timer, node->last_retransmit + rto);
+}
+
+/**
+ * rearm the retransmission timers of all packets in the send buffer with the current timeout
+ * @param   rel_t *
+ * @return  void
+ */
+void rearm_retransmits(rel_t* s) {
+    buffer_node_t* node = buffer_get_first(s->send_buffer);
+    s->armed_rto = 0;
+    while (node) {
+        if (!node->sacked) {
+            arm_retransmit(s, node);
+        }
+        node = buffer_next(s->send_buffer, node);
+    }
+}
+
+/**
+ * whether packets sent before the last loss (before cc.recover) are left to the recovery it started rather than to their
+ * own timers: partial acknowledgements resend them one per round trip (see process_ack). Not with --cc none, whose fixed
+ * window the timers keep to anyway, nor with --fec, where a hole may still be rebuilt from a parity packet in flight
+ * @param   rel_t *
+ * @return  bool
+ */
+bool ack_driven_recovery(rel_t* s) {
+    return strcmp(s->cc.ops->name, "none") != 0 && !ext_enabled(s, EXT_CAP_FEC);
+}
+
+/**
+ * after a retransmission timeout, resend the packets that were in flight then from SND_UNA on, as far as the send
+ * window and the peer's receive window allow, as RFC 6582 does after an RTO; called again whenever an acknowledgement
+ * moves SND_UNA, until the whole flight (up to timed_out_at) has been resent. Only with ack_driven_recovery: otherwise
+ * every packet keeps its own timer
+ * @param   rel_t *
+ * @param   long        the current time
+ * @return  void
+ */
+void resend_flight(rel_t* s, long now) {
+    uint32_t limit = s->SND_UNA + send_window(s);
+    if (s->peer_rwnd >= 0 && seq_lt(s->SND_UNA + s->peer_rwnd, limit)) {
+        limit = s->SND_UNA + s->peer_rwnd;
+    }
+    if (seq_lt(s->timed_out_at, limit)) {
+        limit = s->timed_out_at;
+    }
+    if (seq_lt(s->resend_next, s->SND_UNA)) {
+        s->resend_next = s->SND_UNA;
+    }
+    for (; seq_lt(s->resend_next, limit); s->resend_next = seq_next(s->resend_next)) {
+        buffer_node_t* node = buffer_get(s->send_buffer, s->resend_next);
+        if (node && !node->sacked) {
+            resend_packet(s, node, now);
+            arm_retransmit(s, node);
+        }
+    }
+}
+
+/**
+ * retransmission timer callback of a packet in the send buffer: resend it and rearm the timer
+ * when it is the oldest unacknowledged packet that timed out, back off the timeout; a later packet is only resent
+ * within the send window. When recovery is driven by acknowledgements (see ack_driven_recovery), a later packet sent
+ * before the last loss is left to it instead, and a timeout of the oldest one resends the flight (see resend_flight),
+ * so the oldest packet's timer still covers the rest
+ * @param   tw_timer_t *    the timer embedded in the buffer node
+ * @param   void *          the rel_t the packet belongs to
+ * @return  void
+ */
+void retransmit_packet(tw_timer_t* timer, void* arg) {
+    rel_t* s = arg;
+    buffer_node_t* node = (buffer_node_t*)((char*)timer - offsetof(buffer_node_t, timer));
+    long now = rel_timers.now;
+
+    // The peer has no room for it: while the window is closed, window probes take over and the timer is armed again
+    // once it reopens; beyond an open window, the packet waits for another timeout
+    if (s->peer_rwnd == 0) {
+        return;
+    }
+    if (s->peer_rwnd > 0 && seq_geq(ntohl(node->packet.seqno), s->SND_UNA + s->peer_rwnd)) {
+        tw_timer_add(&rel_timers, &node->timer, currentTimeMillis() + rtt_rto(&s->rtt));
+        return;
+    }
+    if (node == buffer_get_first(s->send_buffer)) {
+        rtt_backoff(&s->rtt);
+        cc_on_timeout(&s->cc, s->SND_NXT, now);
+        s->timed_out_at = s->SND_NXT;
+        // The timeout already does what a tail loss probe would
+        s->tlp_state = 2;
+        tw_timer_del(&s->tlp_timer);
+        resend_packet(s, node, now);
+        arm_retransmit(s, node);
+        // The timers of the rest of the flight are held back, so it is resent from here as the windows allow
+        if (ack_driven_recovery(s)) {
+            s->resend_next = seq_next(ntohl(node->packet.seqno));
+            resend_flight(s, now);
+        }
+        return;
+    }
+    if ((seq_lt(ntohl(node->packet.seqno), s->cc.recover) && ack_driven_recovery(s))
+        || seq_diff(ntohl(node->packet.seqno), s->SND_UNA) >= send_window(s)) {
+        tw_timer_add(&rel_timers, &node->timer, now + rtt_rto(&s->rtt));
+        return;
+    }
+    resend_packet(s, node, now);
+    arm_retransmit(s, node);
+}
+
+/**
+ * (re)arm the tail loss probe timer (--tlp) two SRTTs from now, but no less than TLP_MIN_PTO; stop it if
+ * nothing is in flight, no probe may be sent, or the retransmission timer of the oldest packet expires first anyway
+ * a lone full packet may wait for its acknowledgement as long as the peer delays ACKs, which is taken to be our --delack
+ * @param   rel_t *
+ * @return  void
+ */
+void arm_tail_probe(rel_t* s) {
+    buffer_node_t* first = buffer_get_first(s->send_buffer);
+    long now = currentTimeMillis();
+    long pto = 2 * (s->rtt.srtt8 >> 3);
+
+    if (!s->tlp || s->tlp_state || !s->rtt.has_sample || !first || s->peer_rwnd == 0) {
+        tw_timer_del(&s->tlp_timer);
+        return;
+    }
+    if (pto < TLP_MIN_PTO) {
+        pto = TLP_MIN_PTO;
+    }
+    if (seq_diff(s->SND_NXT, s->SND_UNA) == 1) {
+        pto += s->delack;
+    }
+    if (tw_timer_pending(&first->timer) && first->timer.expires <= now + pto) {
+        tw_timer_del(&s->tlp_timer);
+        return;
+    }
+    tw_timer_add(&rel_timers, &s->tlp_timer, now + pto);
+}
+
+/**
+ * tail loss probe timer callback: no acknowledgement came for a while, resend the newest packet not yet sacked
+ * @param   tw_timer_t *
+ * @param   void *          the rel_t
+ * @return  void
+ */
+void tail_probe(tw_timer_t* timer, void* arg) {
+    rel_t* s = arg;
+    buffer_node_t* node;
+    uint32_t seqno;
+
+    if (buffer_size(s->send_buffer) == 0 || s->peer_rwnd == 0) {
+        return;
+    }
+    // The send buffer holds every packet from SND_UNA to SND_NXT - 1
+    seqno = s->send_buffer->last;
+    node = buffer_get(s->send_buffer, seqno);
+    while (node && node->sacked && seqno != s->SND_UNA) {
+        seqno = seq_prev(seqno);
+        node = buffer_get(s->send_buffer, seqno);
+    }
+    if (!node || node->sacked) {
+        return;
+    }
+    resend_packet(s, node, currentTimeMillis());
+    arm_retransmit(s, node);
+    s->tlp_state = 1;
+    s->stats.tail_probes++;
+}
+
+/**
+ * send a packet of the send buffer again; its timer is left to the caller
+ * @param   rel_t *
+ * @param   buffer_node_t *     the buffer node of the packet
+ * @param   long                the current time
+ * @return  void
+ */
+void resend_packet(rel_t* s, buffer_node_t* node, long now) {
+    conn_sendpkt(s->c, &(node->packet), (size_t)ntohs(node->packet.len));
+    node->last_retransmit = now;
+    node->retransmits++;
+    s->stats.retransmits++;
+    s->stats.last_send = now;
+    s->stats.bytes_retransmitted += ntohs(node->packet.len) - 12;
+}
+
 int is_EOF(packet_t* packet) {
     return (ntohs(packet->len) == (uint16_t)12);
 }
 
-void create_packet(packet_t* packet, int len, int seqno, int ackno, int isData) {
+void create_packet(packet_t* packet, int len, uint32_t seqno, uint32_t ackno, int isData) {
     packet->len = htons((uint16_t)len);
-    packet->ackno = htonl((uint32_t)ackno);
+    packet->ackno = htonl(ackno);
 
     if (isData) {
-        packet->seqno = htonl((uint32_t)seqno);
+        packet->seqno = htonl(seqno);
     }
 
     packet->cksum = (uint16_t)0;
@@ -378,15 +1287,478 @@ bool is_ACK(packet_t* packet) {
     return ntohs(packet->len) == 8;
 }
 
-int MAX(int num1, int num2) {
-    return (num1 > num2) ? num1 : num2;
+/**
+ * acknowledge an in-order packet: right away without --delack or if another one is already waiting for its
+ * acknowledgement, else once the delayed-ACK timer runs out (unless something else is acknowledged before)
+ * @param   rel_t *
+ * @return  void
+ */
+void delay_ack(rel_t* r) {
+    if (!r->delack || ++r->ack_pending >= 2) {
+        create_send_ack(r);
+        return;
+    }
+    if (!tw_timer_pending(&r->delack_timer)) {
+        tw_timer_add(&rel_timers, &r->delack_timer, currentTimeMillis() + r->delack);
+    }
+}
+
+/**
+ * delayed-ACK timer callback: acknowledge the in-order packet still waiting for it
+ * @param   tw_timer_t *
+ * @param   void *          the rel_t
+ * @return  void
+ */
+void delack_expired(tw_timer_t* timer, void* arg) {
+    rel_t* r = arg;
+    r->stats.delack_timeouts++;
+    create_send_ack(r);
 }
 
+/**
+ * send a cumulative acknowledgement of RCV_NXT
+ * with SACK negotiated and packets buffered beyond RCV_NXT, it is a control packet reporting them in a bitmap
+ * @param   rel_t *
+ * @return  void
+ */
 void create_send_ack(rel_t* r) {
-    struct ack_packet* ack_pac = xmalloc(sizeof(struct ack_packet));
-    create_packet((packet_t*)ack_pac, 8, -1, r->RCV_NXT, 0);
-    conn_sendpkt(r->c, (packet_t*)ack_pac, 8);
-    free(ack_pac);
+    send_caps_if_needed(r);
+    // This acknowledges any packet whose acknowledgement was being delayed
+    r->ack_pending = 0;
+    tw_timer_del(&r->delack_timer);
+    buffer_node_t* scratch = pool_get(r->pool);
+    packet_t* ack_pac = &scratch->packet;
+    bool sack = ext_enabled(r, EXT_CAP_SACK) && buffer_size(r->rec_buffer) > 0
+                && seq_gt(r->rec_buffer->last, r->RCV_NXT);
+    if (sack || ext_enabled(r, EXT_CAP_RWND)) {
+        ext_init(ack_pac);
+    }
+    if (ext_enabled(r, EXT_CAP_RWND)) {
+        uint8_t* value = ext_add(ack_pac, EXT_OPT_RWND, 0, 4);
+        r->rwnd_adv = recv_window(r);
+        value[0] = r->rwnd_adv >> 24;
+        value[1] = r->rwnd_adv >> 16;
+        value[2] = r->rwnd_adv >> 8;
+        value[3] = r->rwnd_adv;
+    }
+    if (sack) {
+        uint32_t bits = r->rec_buffer->last - r->RCV_NXT;
+        if (bits > (uint32_t)ext_room(ack_pac) * 8) {
+            bits = ext_room(ack_pac) * 8;
+        }
+        uint8_t* bitmap = ext_add(ack_pac, EXT_OPT_SACK, 0, (bits + 7) / 8);
+        memset(bitmap, 0, (bits + 7) / 8);
+        buffer_node_t* node;
+        for (node = buffer_get_first(r->rec_buffer); node; node = buffer_next(r->rec_buffer, node)) {
+            uint32_t bit = ntohl(node->packet.seqno) - r->RCV_NXT - 1;
+            if (seq_gt(ntohl(node->packet.seqno), r->RCV_NXT) && bit < bits) {
+                bitmap[bit / 8] |= 0x80 >> (bit % 8);
+            }
+        }
+        r->stats.sacks_sent++;
+    }
+    else {
+        r->stats.acks_sent++;
+    }
+    if (sack || ext_enabled(r, EXT_CAP_RWND)) {
+        create_packet(ack_pac, ntohs(ack_pac->len), 0, r->RCV_NXT, 0);
+    }
+    else {
+        create_packet(ack_pac, 8, 0, r->RCV_NXT, 0);
+    }
+    conn_sendpkt(r->c, ack_pac, ntohs(ack_pac->len));
+    pool_put(r->pool, scratch);
+}
+
+/**
+ * process a cumulative acknowledgement: release the acknowledged packets and send new ones
+ * the third duplicate acknowledgement in a row sent for data (i.e. not e.g. for capabilities) means the oldest
+ * packet in flight was lost while later ones arrived: it is retransmitted right away (fast retransmit)
+ * an ackno beyond anything sent yet is bogus (e.g. from a peer using another initial sequence number) and ignored
+ * @param   rel_t *
+ * @param   uint32_t    ackno, the next sequence number the peer is waiting for
+ * @param   bool        whether the peer sent the acknowledgement for a data packet it received
+ * @return  void
+ */
+void process_ack(rel_t* s, uint32_t ackno, bool for_data) {
+    if (seq_gt(ackno, s->SND_NXT)) {
+        return;
+    }
+    buffer_node_t* oldest = buffer_get_first(s->send_buffer);
+    bool covers_resend = seq_gt(ackno, s->SND_UNA) && oldest && oldest->retransmits > 0;
+    // Before the first sample, a duplicate acknowledgement bounds the round trip from above: the packet it was sent for
+    // left no earlier than the oldest one in flight. That is no sample, but it lowers the initial timeout, which is
+    // what repairs a lost first packet whose fast retransmit is lost, too.
+    if (ackno == s->SND_UNA && for_data && !s->rtt.has_sample) {
+        if (oldest && oldest->retransmits == 0) {
+            rtt_seed(&s->rtt, currentTimeMillis() - oldest->last_retransmit);
+        }
+    }
+    // Take an RTT sample from the newest packet acknowledged, unless it was retransmitted (Karn's rule) or already
+    // sampled when it was sacked. A packet sent before the last retransmission timeout may have waited at the peer
+    // for a hole that only the timeout filled: sampling its late acknowledgement would inflate the timeout further.
+    if (seq_gt(ackno, s->SND_UNA)) {
+        buffer_node_t* acked = buffer_get(s->send_buffer, seq_prev(ackno));
+        long now = currentTimeMillis();
+        long sample = -1;
+        if (acked && acked->retransmits == 0 && !acked->sacked && seq_geq(seq_prev(ackno), s->timed_out_at)) {
+            sample = now - acked->last_retransmit;
+            rtt_sample(&s->rtt, sample);
+        }
+        rtt_reset_backoff(&s->rtt);
+        s->dupacks = 0;
+        cc_on_ack(&s->cc, ackno - s->SND_UNA, ackno, sample, now);
+    }
+    // A duplicate acknowledgement answering a tail loss probe means the oldest packet is missing, like the third one
+    else if (ackno == s->SND_UNA && for_data && s->peer_rwnd != 0 && buffer_size(s->send_buffer) > 0
+             && (++s->dupacks == 3 || s->tlp_state == 1)) {
+        buffer_node_t* lost = buffer_get_first(s->send_buffer);
+        resend_packet(s, lost, currentTimeMillis());
+        arm_retransmit(s, lost);
+        s->stats.fast_retransmits++;
+        if (s->tlp_state == 1) {
+            s->stats.probe_recoveries++;
+            s->dupacks = 3;
+        }
+        s->tlp_state = 2;
+        cc_on_loss(&s->cc, s->SND_UNA, s->SND_NXT, currentTimeMillis());
+    }
+    // The flight after a timeout is resent in order, so a packet after the oldest one got there but the oldest one's
+    // resend did not: a single duplicate acknowledgement shows that
+    else if (ackno == s->SND_UNA && for_data && s->dupacks == 1 && seq_lt(s->SND_UNA, s->timed_out_at)
+             && seq_lt(s->SND_UNA, s->resend_next) && ack_driven_recovery(s)) {
+        buffer_node_t* lost = buffer_get_first(s->send_buffer);
+        if (lost && lost->retransmits > 0 && !lost->sacked) {
+            resend_packet(s, lost, currentTimeMillis());
+            arm_retransmit(s, lost);
+        }
+    }
+    buffer_remove(s->send_buffer, ackno);
+    // Timers armed before the estimate settled (e.g. with the initial -t) would leave losses unrepaired for long
+    if (rtt_rto(&s->rtt) < s->armed_rto / 2) {
+        rearm_retransmits(s);
+    }
+    if (seq_gt(ackno, s->SND_UNA)) {
+        s->SND_UNA = ackno;
+        // Keep the mark within reach of the serial comparison above
+        if (seq_gt(s->SND_UNA, s->timed_out_at)) {
+            s->timed_out_at = s->SND_UNA;
+        }
+        if (seq_gt(s->SND_UNA, s->resend_next)) {
+            s->resend_next = s->SND_UNA;
+        }
+        // The window opened after a timeout: resend more of the flight that was out then
+        if (seq_lt(s->SND_UNA, s->timed_out_at) && ack_driven_recovery(s)) {
+            resend_flight(s, currentTimeMillis());
+        }
+        // A partial acknowledgement of a retransmission: the peer is missing the next packet sent before the loss
+        // was noticed, too. Those packets are resent one per round trip this way, instead of by their own timers,
+        // unless the flight after a timeout just resent it.
+        if (covers_resend && seq_lt(s->SND_UNA, s->cc.recover) && ack_driven_recovery(s)) {
+            buffer_node_t* missing = buffer_get_first(s->send_buffer);
+            if (missing && !missing->sacked && seq_geq(ntohl(missing->packet.seqno), s->resend_next)) {
+                resend_packet(s, missing, currentTimeMillis());
+                arm_retransmit(s, missing);
+            }
+        }
+        s->tlp_state = 0;
+        arm_tail_probe(s);
+    }
+    if (s->nagle_seqno && seq_gt(s->SND_UNA, s->nagle_seqno)) {
+        s->nagle_seqno = 0;
+    }
+    // A sacked packet is still acknowledged late if the peer could not deliver it yet: keep the oldest one timed,
+    // so that a lost acknowledgement cannot leave the connection without any timer
+    buffer_node_t* first = buffer_get_first(s->send_buffer);
+    if (first && first->sacked && !tw_timer_pending(&first->timer)) {
+        arm_retransmit(s, first);
+    }
+    if (s->EOF_SENT && ackno == seq_next(s->EOF_seqno)) {
+        s->EOF_ACK_RECV = 1;
+    }
+    rel_read(s);
+}
+
+/**
+ * process a (verified) control packet: its acknowledgement and the options it carries (see ext.h)
+ * @param   rel_t *
+ * @param   packet_t *
+ * @return  void
+ */
+void process_control(rel_t* r, packet_t* pkt) {
+    uint32_t ackno = ntohl(pkt->ackno);
+    uint16_t offset = 0;
+    ext_opt_t opt;
+    bool for_data = false;
+
+    // Only acknowledgements carrying a SACK, or an unchanged open receive window, are sent for data: window updates
+    // and answers to window probes are not duplicate acknowledgements. The window applies before new data is sent.
+    while (ext_next(pkt, &offset, &opt)) {
+        for_data |= opt.type == EXT_OPT_SACK;
+        if (opt.type == EXT_OPT_RWND && opt.len >= 4) {
+            int rwnd = (uint32_t)opt.value[0] << 24 | opt.value[1] << 16 | opt.value[2] << 8 | opt.value[3];
+            for_data |= !(opt.flags & EXT_RWND_PROBE) && rwnd > 0 && rwnd == r->peer_rwnd;
+            peer_window(r, rwnd);
+        }
+    }
+    process_ack(r, ackno, for_data);
+    offset = 0;
+    while (ext_next(pkt, &offset, &opt)) {
+        if (opt.type == EXT_OPT_CAPS && opt.len >= 4) {
+            r->peer_caps = (uint32_t)opt.value[0] << 24 | opt.value[1] << 16 | opt.value[2] << 8 | opt.value[3];
+            if (opt.flags & EXT_CAPS_ACK) {
+                // Confirming capabilities announced only once times a round trip, before any data was acknowledged
+                if (!r->caps_acked && r->caps_sent == 1) {
+                    rtt_sample(&r->rtt, currentTimeMillis() - r->caps_time);
+                }
+                r->caps_acked = 1;
+            }
+            else if (r->caps) {
+                send_caps(r, EXT_CAPS_ACK);
+            }
+        }
+        else if (opt.type == EXT_OPT_MSS && opt.len >= 2) {
+            r->peer_mss = opt.value[0] << 8 | opt.value[1];
+        }
+        else if (opt.type == EXT_OPT_FEC && (opt.flags & EXT_FEC_PARITY)) {
+            repair_packet(r, opt.value, opt.len);
+        }
+        else if (opt.type == EXT_OPT_FEC && opt.len >= 2) {
+            r->peer_fec = opt.value[0] << 8 | opt.value[1];
+        }
+        else if (opt.type == EXT_OPT_SACK) {
+            process_sack(r, ackno, opt.value, opt.len);
+        }
+        else if (opt.type == EXT_OPT_RWND && (opt.flags & EXT_RWND_PROBE)) {
+            create_send_ack(r);
+        }
+    }
+}
+
+/**
+ * mark the packets in flight a SACK bitmap reports as received, so they are no longer retransmitted
+ * @param   rel_t *
+ * @param   uint32_t            ackno of the packet, the bitmap starts at ackno + 1
+ * @param   const uint8_t *     the bitmap
+ * @param   uint16_t            its length in bytes
+ * @return  void
+ */
+void process_sack(rel_t* s, uint32_t ackno, const uint8_t* bitmap, uint16_t len) {
+    buffer_node_t* newest = NULL;
+    uint32_t bit;
+    for (bit = 0; bit < (uint32_t)len * 8; bit++) {
+        if (bitmap[bit / 8] & (0x80 >> (bit % 8))) {
+            buffer_node_t* node = buffer_get(s->send_buffer, ackno + 1 + bit);
+            if (node && !node->sacked) {
+                node->sacked = 1;
+                tw_timer_del(&node->timer);
+                s->stats.sacked++;
+                newest = node;
+            }
+        }
+    }
+    // The newest packet sacked for the first time is the one whose arrival triggered the SACK
+    if (newest && newest->retransmits == 0) {
+        rtt_sample(&s->rtt, currentTimeMillis() - newest->last_retransmit);
+    }
+}
+
+/**
+ * take the receive window the peer advertised (--rwnd); when it closes, window probes replace retransmissions, when it
+ * reopens, the oldest packet in flight (which the peer most likely dropped) is sent again and the timers rearmed
+ * @param   rel_t *
+ * @param   int         the window, in packets from the ackno it came with
+ * @return  void
+ */
+void peer_window(rel_t* s, int rwnd) {
+    int was = s->peer_rwnd;
+    s->peer_rwnd = rwnd < 0 ? 0 : rwnd;
+    if (s->peer_rwnd == 0 && was != 0) {
+        s->stats.zero_windows++;
+        s->persist_ivl = rtt_rto(&s->rtt);
+        tw_timer_add(&rel_timers, &s->persist_timer, currentTimeMillis() + s->persist_ivl);
+    }
+    else if (s->peer_rwnd > 0 && was == 0) {
+        // The timers are armed from now: the last transmissions lie a whole stall back, and rel_timer has not run
+        // since, so arming them from then would fire them over and over while the timer wheel catches up
+        long now = currentTimeMillis();
+        buffer_node_t* node = buffer_get_first(s->send_buffer);
+        tw_timer_del(&s->persist_timer);
+        s->dupacks = 0;
+        if (node && !node->sacked) {
+            resend_packet(s, node, now);
+        }
+        for (; node; node = buffer_next(s->send_buffer, node)) {
+            if (!node->sacked) {
+                tw_timer_add(&rel_timers, &node->timer, now + rtt_rto(&s->rtt));
+            }
+        }
+    }
+}
+
+/**
+ * persist timer callback: the peer's window is still closed, ask for it again and back off
+ * @param   tw_timer_t *
+ * @param   void *          the rel_t
+ * @return  void
+ */
+void persist_probe(tw_timer_t* timer, void* arg) {
+    rel_t* s = arg;
+    buffer_node_t* scratch = pool_get(s->pool);
+    packet_t* pkt = &scratch->packet;
+    uint8_t* value;
+
+    ext_init(pkt);
+    value = ext_add(pkt, EXT_OPT_RWND, EXT_RWND_PROBE, 4);
+    s->rwnd_adv = recv_window(s);
+    value[0] = s->rwnd_adv >> 24;
+    value[1] = s->rwnd_adv >> 16;
+    value[2] = s->rwnd_adv >> 8;
+    value[3] = s->rwnd_adv;
+    create_packet(pkt, ntohs(pkt->len), 0, s->RCV_NXT, 0);
+    conn_sendpkt(s->c, pkt, ntohs(pkt->len));
+    pool_put(s->pool, scratch);
+    s->stats.window_probes++;
+
+    s->persist_ivl = s->persist_ivl * 2 < s->rtt.rto_max ? s->persist_ivl * 2 : s->rtt.rto_max;
+    tw_timer_add(&rel_timers, &s->persist_timer, rel_timers.now + s->persist_ivl);
+}
+
+/**
+ * send our capabilities to the peer in a control packet
+ * @param   rel_t *
+ * @param   uint8_t     flags of the option (EXT_CAPS_ACK when answering the peer's capabilities)
+ * @return  void
+ */
+void send_caps(rel_t* r, uint8_t flags) {
+    buffer_node_t* scratch = pool_get(r->pool);
+    packet_t* pkt = &scratch->packet;
+    ext_init(pkt);
+    uint8_t* value = ext_add(pkt, EXT_OPT_CAPS, flags, 4);
+    value[0] = r->caps >> 24;
+    value[1] = r->caps >> 16;
+    value[2] = r->caps >> 8;
+    value[3] = r->caps;
+    if (r->caps & EXT_CAP_MSS) {
+        value = ext_add(pkt, EXT_OPT_MSS, 0, 2);
+        value[0] = r->mss >> 8;
+        value[1] = r->mss;
+    }
+    if (r->caps & EXT_CAP_FEC) {
+        value = ext_add(pkt, EXT_OPT_FEC, 0, 2);
+        value[0] = r->fec >> 8;
+        value[1] = r->fec;
+    }
+    create_packet(pkt, ntohs(pkt->len), 0, r->RCV_NXT, 0);
+    conn_sendpkt(r->c, pkt, ntohs(pkt->len));
+    pool_put(r->pool, scratch);
+    if (!(flags & EXT_CAPS_ACK)) {
+        r->caps_sent++;
+        r->caps_time = currentTimeMillis();
+    }
+}
+
+/**
+ * announce our capabilities before the first packet we send, and again (at most once per timeout and three times
+ * in total) along with later packets until the peer confirms them; peers without extensions never do
+ * @param   rel_t *
+ * @return  void
+ */
+void send_caps_if_needed(rel_t* r) {
+    if (!r->caps || r->caps_acked || r->caps_sent >= 3) {
+        return;
+    }
+    if (r->caps_sent == 0 || currentTimeMillis() - r->caps_time >= rtt_rto(&r->rtt)) {
+        send_caps(r, 0);
+    }
+}
+
+/**
+ * add a new data packet to its parity group (--fec) and send the parity once the group is complete, or EOF ends it
+ * @param   rel_t *
+ * @param   packet_t *  the packet just sent for the first time
+ * @return  void
+ */
+void protect_packet(rel_t* s, packet_t* packet) {
+    if (!ext_enabled(s, EXT_CAP_FEC)) {
+        return;
+    }
+    if (!s->fec_out) {
+        s->fec_out = xmalloc(sizeof(fec_t));
+        fec_init(s->fec_out, s->fec, 1, s->mss);
+    }
+    if (fec_add_sent(s->fec_out, packet) || (is_EOF(packet) && fec_pending(s->fec_out))) {
+        send_parity(s);
+    }
+}
+
+/**
+ * send the parity of the group just completed in a control packet, as long as a full data packet
+ * @param   rel_t *
+ * @return  void
+ */
+void send_parity(rel_t* s) {
+    buffer_node_t* scratch = pool_get(s->pool);
+    packet_t* pkt = &scratch->packet;
+    ext_init(pkt);
+    uint8_t* value = ext_add_upto(pkt, EXT_OPT_FEC, EXT_FEC_PARITY, fec_parity_len(s->fec_out),
+                                  EXT_HEADER_LEN + payload_size(s) + FEC_OVERHEAD);
+    fec_parity(s->fec_out, value);
+    if (value) {
+        create_packet(pkt, ntohs(pkt->len), 0, s->RCV_NXT, 0);
+        conn_sendpkt(s->c, pkt, ntohs(pkt->len));
+        s->stats.parity_sent++;
+    }
+    pool_put(s->pool, scratch);
+}
+
+/**
+ * add a data packet received for the first time to the peer's parity group it belongs to (--fec)
+ * @param   rel_t *
+ * @param   packet_t *
+ * @return  void
+ */
+void absorb_packet(rel_t* r, packet_t* pkt) {
+    if (!ext_enabled(r, EXT_CAP_FEC) || r->peer_fec < 1 || r->peer_fec > FEC_MAX_GROUP) {
+        return;
+    }
+    if (!r->fec_in) {
+        r->fec_in = xmalloc(sizeof(fec_t));
+        fec_init(r->fec_in, r->peer_fec, r->MAXWND / r->peer_fec + 2, r->mss);
+    }
+    fec_add_received(r->fec_in, pkt);
+}
+
+/**
+ * rebuild the one packet a parity packet's group is missing, if that is all it is missing, and take it like any
+ * data packet received
+ * @param   rel_t *
+ * @param   const uint8_t *     the parity (EXT_OPT_FEC value)
+ * @param   uint16_t            its length
+ * @return  void
+ */
+void repair_packet(rel_t* r, const uint8_t* value, uint16_t len) {
+    if (!r->fec_in) {
+        return;
+    }
+    buffer_node_t* scratch = pool_get(r->pool);
+    packet_t* pkt = &scratch->packet;
+    if (fec_repair(r->fec_in, value, len, pkt)) {
+        r->stats.repaired++;
+        create_packet(pkt, ntohs(pkt->len), ntohl(pkt->seqno), 0, 1);
+        rel_recvpkt(r, pkt, ntohs(pkt->len));
+    }
+    pool_put(r->pool, scratch);
+}
+
+/**
+ * check whether an extension is used on the connection, i.e. enabled on both sides
+ * @param   rel_t *
+ * @param   uint32_t    the extension (EXT_CAP_*)
+ * @return  bool
+ */
+bool ext_enabled(rel_t* r, uint32_t cap) {
+    return (r->caps & r->peer_caps & cap) != 0;
 }
 
 bool enough_space(rel_t* r, packet_t* pkt) {
@@ -1,8 +1,12 @@
 /* rlib version 5 */
 
+#if USE_MMSG
+#define _GNU_SOURCE		/* recvmmsg, sendmmsg */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -12,12 +16,19 @@
 #include <assert.h>
 #include <stddef.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#if USE_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #include "rlib.h"
+#include "cc.h"
+#include "cksum.h"
 
 char *progname;
 int opt_debug;
@@ -32,32 +43,108 @@ struct config_server {
     address */
 };
 
-static struct config_server *serverconf;
+static THREAD_LOCAL struct config_server *serverconf;
+
+/* The fastest checksum the CPU supports (see cksum.h), selected by main
+ * before any worker thread starts, so that the threads only read it */
+static cksum_fn_t cksum_impl;
 
 static void conn_mkevents (void);
+#if !USE_MMSG
 static int debug_recv (int s, packet_t *buf, size_t len, int flags,
 struct sockaddr_storage *from);
+#endif
+
+#if USE_EPOLL
+/* Each connection registers its own file descriptors with the epoll
+ * instance (level-triggered).  Changes to what a connection waits for
+ * only mark it dirty; the registrations of dirty connections are
+ * brought up to date once per loop iteration, so a connection that
+ * turns reading off and back on again costs no system call. */
+struct evreg {
+    conn_t *conn;		/* NULL for stderr */
+    int fd;
+    int events;			/* registered events, -1 if not registered */
+    char nopoll;		/* fd can't be polled (regular file), always
+				   ready */
+    char dead;			/* error or hangup, stop polling */
+};
 
-int cevents_generation;
-static struct pollfd *cevents;
-static int ncevents;
-static conn_t **evreaders;
-static conn_t **evwriters;
-
-struct chunk {
-    struct chunk *next;
-    size_t size;
-    size_t used;
-    char buf[1];
+#define EV_MAX 64		/* events handled per epoll_wait */
+
+static THREAD_LOCAL int epfd = -1;
+static THREAD_LOCAL struct evreg everr;	/* stderr, to catch errors */
+static THREAD_LOCAL struct evreg evudp;	/* the server's UDP socket */
+static THREAD_LOCAL struct evreg *evsendq;	/* registered for EPOLLOUT
+						   while the queue is blocked */
+static THREAD_LOCAL conn_t *evdirty;		/* connections with outdated registrations */
+
+static void conn_dirty (conn_t *c);
+static void evreg_sync (struct evreg *e, int want,
+                        struct epoll_event *ready, int *nready);
+#else /* !USE_EPOLL */
+THREAD_LOCAL int cevents_generation;
+static THREAD_LOCAL struct pollfd *cevents;
+static THREAD_LOCAL int ncevents;
+static THREAD_LOCAL conn_t **evreaders;
+static THREAD_LOCAL conn_t **evwriters;
+#endif /* !USE_EPOLL */
+static THREAD_LOCAL int ndeleted;		/* connections waiting for conn_free */
+
+/* Packets passed to conn_sendpkt are queued and sent together (with
+ * sendmmsg if available) at the end of each loop iteration, or
+ * earlier if the queue is full or a packet for another socket comes
+ * along.  Likewise, a readable socket is drained of up to RECV_BATCH
+ * datagrams with one recvmmsg. */
+#define SEND_BATCH 64
+#define RECV_BATCH 32
+#define SERVER_RECV_ROUNDS 8
+#define SERVER_RCVBUF (4 << 20)	/* requested, capped by net.core.rmem_max */
+
+/* Packet buffers hold the largest packet the configured mss allows
+ * rather than a whole packet_t (PACKET_DATA_MAX), and are allocated once
+ * per thread by pktbuf_init */
+static THREAD_LOCAL size_t pktsize;	/* bytes per buffer */
+static THREAD_LOCAL char *recvbuf;	/* RECV_BATCH buffers */
+#define PKTBUF(buf, i) ((packet_t *) ((buf) + (size_t) (i) * pktsize))
+
+/* A ring of queued packets, whose buffers are PKTBUF (buf, i) */
+struct sendq {
+    int fd;			/* socket all queued packets go out on */
+    int head;			/* first queued packet */
+    int n;			/* number of queued packets */
+    int blocked;		/* the socket took no more (EAGAIN), the rest
+				   waits for it to become writable */
+    char *buf;			/* SEND_BATCH buffers */
+    struct {
+        size_t len;
+        struct sockaddr_storage to;
+        socklen_t tolen;	/* 0 on connected sockets */
+    } e[SEND_BATCH];
 };
-typedef struct chunk chunk_t;
+static THREAD_LOCAL struct sendq sendq;
+
+struct batch_stats {
+    unsigned long calls;	/* system calls that moved datagrams */
+    unsigned long datagrams;
+    unsigned long max;		/* largest batch */
+};
+static THREAD_LOCAL struct batch_stats recv_batches, send_batches;
 
 struct conn {
     rel_t *rel;			/* Data from reliable */
 
+#if USE_EPOLL
+    struct evreg rev;		/* rfd (and wfd if the same) */
+    struct evreg wev;		/* wfd */
+    struct evreg nev;		/* nfd */
+    struct conn *dnext;		/* List of dirty connections */
+    struct conn **dprev;
+#else /* !USE_EPOLL */
     int rpoll;			/* offsets into cevents array */
     int wpoll;
     int npoll;
+#endif /* !USE_EPOLL */
 
     int rfd;			/* input file descriptor */
     int wfd;			/* output file descriptor */
@@ -70,15 +157,28 @@ struct conn {
     char write_err;	        /* zero if it's okay to write to wfd */
     char xoff;			/* non-zero to pause reading */
     char delete_me;		/* delete after draining */
-    chunk_t *outq;		/* chunks not yet written */
-    chunk_t **outqtail;
+    char *outq;			/* ring of output not yet written */
+    size_t outqsize;		/* capacity of outq */
+    size_t outqhead;		/* offset of the oldest byte in outq */
+    size_t outqlen;		/* bytes in outq not yet written */
+    size_t outbuf;		/* limit of outqlen for conn_bufspace */
 
     struct conn *next;		/* Linked list of connections */
     struct conn **prev;
+
+    struct conn *hnext;		/* Chain in peertab (server only) */
+    unsigned int hash;		/* addrhash (&peer) */
 };
 
-static conn_t *conn_list;
-struct timespec last_timeout;
+static THREAD_LOCAL conn_t *conn_list;
+
+/* Server connections by peer address, to demultiplex the datagrams
+ * arriving on the server's UDP socket.  Chained hash table whose size
+ * is a power of two, doubled whenever it holds as many connections as
+ * it has buckets. */
+static THREAD_LOCAL conn_t **peertab;
+static THREAD_LOCAL unsigned int peertab_size;
+static THREAD_LOCAL unsigned int npeers;
 
 #if !DMALLOC
 void *
@@ -86,8 +186,8 @@ xmalloc (size_t n)
 {
     void *p = malloc (n);
     if (!p) {
-        fprintf (stderr, "%s: out of memory allocating %d bytes\n",
-        progname, (int) n);
+        fprintf (stderr, "%s: out of memory allocating %zu bytes\n",
+        progname, n);
         abort ();
     }
     return p;
@@ -139,49 +239,235 @@ print_pkt (const packet_t *buf, const char *op, int n)
     errno = saved_errno;
 }
 
+static void
+batch_count (struct batch_stats *b, int n)
+{
+    b->calls++;
+    b->datagrams += n;
+    if (n > b->max)
+        b->max = n;
+}
+
+static void
+batch_print (const char *op, const struct batch_stats *b)
+{
+    fprintf (stderr, "%s %lu calls, %lu datagrams (avg %.1f, max %lu)",
+             op, b->calls, b->datagrams,
+             b->calls ? (double) b->datagrams / b->calls : 0.0, b->max);
+}
+
+/* Allocate the packet buffers of this thread for packets of up to mss
+ * bytes of payload */
+static void
+pktbuf_init (int mss)
+{
+    /* Rounded up so that every buffer is aligned for packet_t */
+    pktsize = (offsetof (packet_t, data) + mss + 7) & ~(size_t) 7;
+    recvbuf = xmalloc (RECV_BATCH * pktsize);
+    sendq.buf = xmalloc (SEND_BATCH * pktsize);
+}
+
+/* Drop the queued packets */
+static void
+sendq_drop (void)
+{
+    int i, k;
+
+    if (opt_debug)
+        for (i = 0; i < sendq.n; i++) {
+            k = (sendq.head + i) % SEND_BATCH;
+            print_pkt (PKTBUF (sendq.buf, k), "drop", sendq.e[k].len);
+        }
+    sendq.head = sendq.n = 0;
+    sendq.blocked = 0;
+}
+
+/* Decide how to go on after a failed send of the queued packet pkt.
+ * Returns -1 to stop on EAGAIN: the rest of the queue waits for the
+ * socket to become writable (see conn_wait).  Otherwise returns the
+ * number of packets to skip: none to try again after EINTR, pkt itself
+ * for any other error, like an ECONNREFUSED left pending by an earlier
+ * datagram. */
+static int
+sendq_skip (const packet_t *pkt)
+{
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        sendq.blocked = 1;
+        return -1;
+    }
+    if (errno == EINTR)
+        return 0;
+    if (opt_debug)
+        print_pkt (pkt, "send", -1);
+    return 1;
+}
+
+/* Send the queued packets, as far as the socket takes them */
+static void
+sendq_flush (void)
+{
+    int k, n, sent = 0;
+#if USE_MMSG
+    int i;
+    struct mmsghdr msg[SEND_BATCH];
+    struct iovec iov[SEND_BATCH];
+#endif /* USE_MMSG */
+
+    sendq.blocked = 0;
+    if (!sendq.n)
+        return;
+
+#if USE_MMSG
+    memset (msg, 0, sendq.n * sizeof (msg[0]));
+    for (i = 0; i < sendq.n; i++) {
+        k = (sendq.head + i) % SEND_BATCH;
+        iov[i].iov_base = PKTBUF (sendq.buf, k);
+        iov[i].iov_len = sendq.e[k].len;
+        msg[i].msg_hdr.msg_iov = &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+        if (sendq.e[k].tolen) {
+            msg[i].msg_hdr.msg_name = &sendq.e[k].to;
+            msg[i].msg_hdr.msg_namelen = sendq.e[k].tolen;
+        }
+    }
+    /* sendmmsg stops at a message that fails and reports the error only
+     * if it is the first one, so the loop gets there on the next call */
+    while (sent < sendq.n) {
+        n = sendmmsg (sendq.fd, msg + sent, sendq.n - sent, 0);
+        if (n > 0) {
+            batch_count (&send_batches, n);
+            if (opt_debug)
+                for (i = sent; i < sent + n; i++)
+                    print_pkt (iov[i].iov_base, "send", msg[i].msg_len);
+            sent += n;
+        }
+        else if ((n = sendq_skip (iov[sent].iov_base)) < 0)
+            break;
+        else
+            sent += n;
+    }
+#else /* !USE_MMSG */
+    while (sent < sendq.n) {
+        k = (sendq.head + sent) % SEND_BATCH;
+        if (sendq.e[k].tolen)
+            n = sendto (sendq.fd, PKTBUF (sendq.buf, k), sendq.e[k].len, 0,
+                        (const struct sockaddr *) &sendq.e[k].to,
+                        sendq.e[k].tolen);
+        else
+            n = send (sendq.fd, PKTBUF (sendq.buf, k), sendq.e[k].len, 0);
+        if (n >= 0) {
+            batch_count (&send_batches, 1);
+            if (opt_debug)
+                print_pkt (PKTBUF (sendq.buf, k), "send", n);
+            sent++;
+        }
+        else if ((n = sendq_skip (PKTBUF (sendq.buf, k))) < 0)
+            break;
+        else
+            sent += n;
+    }
+#endif /* !USE_MMSG */
+    sendq.head = (sendq.head + sent) % SEND_BATCH;
+    sendq.n -= sent;
+}
+
 int
 conn_sendpkt (conn_t *c, const packet_t *pkt, size_t len)
 {
-    int n;
-    assert (!c->delete_me);
-    if (c->server)
-        n = sendto (c->nfd, pkt, len, 0,
-                    (const struct sockaddr *) &c->peer, addrsize (&c->peer));
+    int k;
+
+    assert (!c->delete_me && len <= pktsize);
+    /* What another socket did not take yet is given up, the queue only
+     * holds packets for one */
+    if (sendq.n && sendq.fd != c->nfd) {
+        sendq_flush ();
+        sendq_drop ();
+    }
+    if (sendq.n == SEND_BATCH) {
+        sendq_flush ();
+        /* A full queue the socket takes nothing of drops the packet, as
+         * a full socket buffer would */
+        if (sendq.n == SEND_BATCH) {
+            if (opt_debug)
+                print_pkt (pkt, "drop", len);
+            return -1;
+        }
+    }
+
+    sendq.fd = c->nfd;
+    k = (sendq.head + sendq.n) % SEND_BATCH;
+    memcpy (PKTBUF (sendq.buf, k), pkt, len);
+    sendq.e[k].len = len;
+    if (c->server) {
+        sendq.e[k].to = c->peer;
+        sendq.e[k].tolen = addrsize (&c->peer);
+    }
     else
-        n = send (c->nfd, pkt, len, 0);
-    if (opt_debug)
-        print_pkt (pkt, "send", n);
-    return n;
+        sendq.e[k].tolen = 0;
+    sendq.n++;
+    return len;
+}
+
+int
+conn_mtu (conn_t *c)
+{
+#ifdef IP_MTU
+    int mtu;
+    socklen_t len = sizeof (mtu);
+
+    if (!c->server && c->peer.ss_family == AF_INET
+            && getsockopt (c->nfd, IPPROTO_IP, IP_MTU, &mtu, &len) == 0)
+        return mtu;
+#endif /* IP_MTU */
+    return 0;
 }
 
 size_t
 conn_bufspace (conn_t *c)
 {
-    chunk_t *ch;
-    size_t used = 0;
-    const size_t bufsize = 8192;
+    return c->outqlen > c->outbuf ? 0 : c->outbuf - c->outqlen;
+}
 
+/* Append n bytes to the output ring, growing it if they do not fit */
+static void
+outq_append (conn_t *c, const char *buf, size_t n)
+{
+    size_t tail, first;
+
+    if (c->outqlen + n > c->outqsize) {
+        size_t size = c->outqsize ? 2 * c->outqsize : 4096;
+        char *q;
+        while (size < c->outqlen + n)
+            size *= 2;
+        q = xmalloc (size);
+        first = c->outqsize - c->outqhead;
+        if (first > c->outqlen)
+            first = c->outqlen;
+        memcpy (q, c->outq + c->outqhead, first);
+        memcpy (q + first, c->outq, c->outqlen - first);
+        free (c->outq);
+        c->outq = q;
+        c->outqsize = size;
+        c->outqhead = 0;
+    }
 
-    for (ch = c->outq; ch; ch = ch->next)
-        used += (ch->size - ch->used);
-    return used > bufsize ? 0 : bufsize - used;
+    tail = (c->outqhead + c->outqlen) % c->outqsize;
+    first = c->outqsize - tail;
+    if (first > n)
+        first = n;
+    memcpy (c->outq + tail, buf, first);
+    memcpy (c->outq, buf + first, n - first);
+    c->outqlen += n;
 }
 
 int
-conn_output (conn_t *c, const void *_buf, size_t _n)
+conn_outputv (conn_t *c, const struct iovec *iov, int iovcnt)
 {
-    const char *buf = _buf;
-    int n = _n;
+    int i, r = 0, total = 0;
+    size_t skip;
 
     assert (!c->delete_me && !c->write_eof);
 
-    if (n == 0) {
-        c->write_eof = 1;
-        if (!c->outq)
-            shutdown (c->wfd, SHUT_WR);
-        return 0;
-    }
-
     if (c->write_err) {
         if (c->write_err == 2)
             fprintf (stderr, "conn_output: attempt to write after error\n");
@@ -192,37 +478,61 @@ conn_output (conn_t *c, const void *_buf, size_t _n)
     if (!conn_bufspace (c))
         return 0;
 
-    if (log_out >= 0)
-        write (log_out, buf, n);
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+        if (log_out >= 0)
+            write (log_out, iov[i].iov_base, iov[i].iov_len);
+    }
 
-    if (!c->outq) {
-        int r = write (c->wfd, buf, n);
+    /* Older output goes first, so write directly only if none is
+     * queued; whatever the write does not take is queued */
+    if (!c->outqlen) {
+        r = writev (c->wfd, iov, iovcnt);
         if (r < 0) {
             if (errno != EAGAIN) {
                 perror ("write");
                 c->write_err = 2;
                 return -1;
             }
+            r = 0;
         }
-        else {
-            buf += r;
-            n -= r;
+    }
+    for (skip = r, i = 0; i < iovcnt; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
         }
+        outq_append (c, (const char *) iov[i].iov_base + skip,
+                     iov[i].iov_len - skip);
+        skip = 0;
     }
 
-    if (n > 0) {
-        chunk_t *ch = xmalloc (offsetof (chunk_t, buf[n]));
-        ch->next = NULL;
-        ch->size = n;
-        ch->used = 0;
-        memcpy (ch->buf, buf, n);
-        *c->outqtail = ch;
-        c->outqtail = &ch->next;
+#if USE_EPOLL
+    conn_dirty (c);
+#else /* !USE_EPOLL */
+    if (c->wpoll && c->outqlen)
+    cevents[c->wpoll].events |= POLLOUT;
+#endif /* !USE_EPOLL */
+    return total;
+}
+
+int
+conn_output (conn_t *c, const void *buf, size_t n)
+{
+    struct iovec iov;
+
+    assert (!c->delete_me && !c->write_eof);
+
+    if (n == 0) {
+        c->write_eof = 1;
+        if (!c->outqlen)
+            shutdown (c->wfd, SHUT_WR);
+        return 0;
     }
 
-    if (c->wpoll && c->outq)
-    cevents[c->wpoll].events |= POLLOUT;
-    return _n;
+    iov.iov_base = (void *) buf;
+    iov.iov_len = n;
+    return conn_outputv (c, &iov, 1);
 }
 
 int
@@ -239,6 +549,9 @@ conn_input (conn_t *c, void *buf, size_t n)
             errno = EIO;
         r = -1;
         c->read_eof = 1;
+#if USE_EPOLL
+        conn_dirty (c);
+#endif
         return r;
     }
     if (r < 0 && errno == EAGAIN)
@@ -248,7 +561,11 @@ conn_input (conn_t *c, void *buf, size_t n)
         write (log_in, buf, r);
 
     c->xoff = 0;
+#if USE_EPOLL
+    conn_dirty (c);
+#else /* !USE_EPOLL */
     cevents[c->rpoll].events |= POLLIN;
+#endif /* !USE_EPOLL */
     return r;
 }
 
@@ -259,16 +576,76 @@ conn_alloc (void)
     memset (c, 0, sizeof (*c));
     c->prev = &conn_list;
     c->next = conn_list;
-    c->outqtail = &c->outq;
     if (conn_list)
         conn_list->prev = &c->next;
     conn_list = c;
 
+#if USE_EPOLL
+    c->rev.conn = c->wev.conn = c->nev.conn = c;
+    c->rev.events = c->wev.events = c->nev.events = -1;
+    conn_dirty (c);
+#else /* !USE_EPOLL */
     cevents_generation++;
+#endif /* !USE_EPOLL */
 
     return c;
 }
 
+static conn_t *
+peer_lookup (const struct sockaddr_storage *ss)
+{
+    unsigned int h;
+    conn_t *c;
+
+    if (!npeers)
+        return NULL;
+    h = addrhash (ss);
+    for (c = peertab[h & (peertab_size - 1)]; c; c = c->hnext)
+        if (c->hash == h && addreq (&c->peer, ss))
+            return c;
+    return NULL;
+}
+
+static void
+peer_insert (conn_t *c)
+{
+    conn_t **tab, *nc;
+    unsigned int i, size;
+
+    if (npeers >= peertab_size) {
+        size = peertab_size ? 2 * peertab_size : 64;
+        tab = xmalloc (size * sizeof (*tab));
+        memset (tab, 0, size * sizeof (*tab));
+        for (i = 0; i < peertab_size; i++)
+            for (; peertab[i]; peertab[i] = nc) {
+                nc = peertab[i]->hnext;
+                peertab[i]->hnext = tab[peertab[i]->hash & (size - 1)];
+                tab[peertab[i]->hash & (size - 1)] = peertab[i];
+            }
+        free (peertab);
+        peertab = tab;
+        peertab_size = size;
+    }
+
+    c->hash = addrhash (&c->peer);
+    c->hnext = peertab[c->hash & (peertab_size - 1)];
+    peertab[c->hash & (peertab_size - 1)] = c;
+    npeers++;
+}
+
+static void
+peer_remove (conn_t *c)
+{
+    conn_t **cp;
+
+    for (cp = &peertab[c->hash & (peertab_size - 1)]; *cp; cp = &(*cp)->hnext)
+        if (*cp == c) {
+            *cp = c->hnext;
+            npeers--;
+            return;
+        }
+}
+
 conn_t *
 conn_create (rel_t *rel, const struct sockaddr_storage *ss)
 {
@@ -299,6 +676,8 @@ conn_create (rel_t *rel, const struct sockaddr_storage *ss)
     c->nfd = serverconf->udp_socket;
     c->rfd = c->wfd = n;
     c->server = 1;
+    c->outbuf = serverconf->c.outbuf;
+    peer_insert (c);
 
     return c;
 }
@@ -306,24 +685,41 @@ conn_create (rel_t *rel, const struct sockaddr_storage *ss)
 static void
 conn_free (conn_t *c)
 {
-    chunk_t *ch, *nch;
-
-    for (ch = c->outq; ch; ch = nch) {
-        nch = ch->next;
-        free (ch);
-    }
+    free (c->outq);
 
     if (c->next)
         c->next->prev = c->prev;
     *c->prev = c->next;
+    if (c->delete_me)
+        ndeleted--;
+    if (c->server)
+        peer_remove (c);
+
+#if USE_EPOLL
+    if (c->dprev) {
+        if (c->dnext)
+            c->dnext->dprev = c->dprev;
+        *c->dprev = c->dnext;
+    }
+    evreg_sync (&c->rev, -1, NULL, NULL);
+    evreg_sync (&c->wev, -1, NULL, NULL);
+    evreg_sync (&c->nev, -1, NULL, NULL);
+    if (evsendq == &c->nev)
+        evsendq = NULL;
+#endif /* USE_EPOLL */
 
     close (c->rfd);
     if (c->wfd != c->rfd)
         close (c->wfd);
-    if (!c->server)
+    if (!c->server) {
+        if (sendq.n && sendq.fd == c->nfd)
+            sendq_drop ();
         close (c->nfd);
+    }
 
+#if !USE_EPOLL
     cevents_generation++;
+#endif /* !USE_EPOLL */
 
     /* to help catch errors */
     memset (c, 0xc5, sizeof (*c));
@@ -333,49 +729,459 @@ conn_free (conn_t *c)
 void
 conn_destroy (conn_t *c)
 {
+    if (!c->delete_me)
+        ndeleted++;
     c->delete_me = 1;
+#if USE_EPOLL
+    conn_dirty (c);
+#endif
 }
 
 void
 conn_drain (conn_t *c)
 {
-    chunk_t *ch;
-    int didsome = 0;
+    struct iovec iov[2];
+    int n = 0;
 
+#if USE_EPOLL
+    conn_dirty (c);
+#else /* !USE_EPOLL */
     if (c->wpoll)
         cevents[c->wpoll].events &= ~POLLOUT;
+#endif /* !USE_EPOLL */
 
     if (c->write_err)
         return;
 
-    while ((ch = c->outq)) {
-        int n = write (c->wfd, ch->buf + ch->used,
-        ch->size - ch->used);
+    /* The queued output is one segment of the ring, or two if it
+     * wraps around */
+    if (c->outqlen) {
+        iov[0].iov_base = c->outq + c->outqhead;
+        iov[0].iov_len = c->outqsize - c->outqhead;
+        if (iov[0].iov_len > c->outqlen)
+            iov[0].iov_len = c->outqlen;
+        iov[1].iov_base = c->outq;
+        iov[1].iov_len = c->outqlen - iov[0].iov_len;
+
+        n = writev (c->wfd, iov, iov[1].iov_len ? 2 : 1);
         if (n < 0) {
             if (errno != EAGAIN)
                 c->write_err = 1;
-            break;
-        }
-        didsome = 1;
-        ch->used += n;
-        if (ch->used < ch->size) {
-            if (c->wpoll)
-                cevents[c->wpoll].events |= POLLOUT;
-            break;
+            return;
         }
-        c->outq = ch->next;
-        if (!c->outq)
-            c->outqtail = &c->outq;
-        free (ch);
+        c->outqhead = (c->outqhead + n) % c->outqsize;
+        c->outqlen -= n;
+        if (!c->outqlen)
+            c->outqhead = 0;
+#if !USE_EPOLL
+        else if (c->wpoll)
+            cevents[c->wpoll].events |= POLLOUT;
+#endif /* !USE_EPOLL */
     }
-    if (c->write_eof && !c->write_err && !c->outq) {
+
+    if (c->write_eof && !c->write_err && !c->outqlen) {
         c->write_err = 1;
         shutdown (c->wfd, SHUT_WR);
     }
-    if (didsome && !c->delete_me)
+    if (n > 0 && !c->delete_me)
         rel_output (c->rel);
 }
 
+/* The peer's port is unreachable (ICMP error on the network socket) */
+static void
+conn_unreachable (conn_t *c, const struct config_common *cc)
+{
+    char addr[NI_MAXHOST] = "unknown";
+    char port[NI_MAXSERV] = "unknown";
+    getnameinfo ((const struct sockaddr *) &c->peer, sizeof (c->peer),
+    addr, sizeof (addr), port, sizeof (port),
+    NI_DGRAM | NI_NUMERICHOST|NI_NUMERICSERV);
+    fprintf (stderr, "[received ICMP port unreachable;"
+    " assuming peer at %s:%s is dead]\n", addr, port);
+    if (cc->single_connection)
+    exit (1);
+    rel_destroy (c->rel);
+}
+
+#if USE_MMSG
+/* Receive up to RECV_BATCH packets on a client's network socket */
+static void
+conn_recv (conn_t *c)
+{
+    struct mmsghdr msg[RECV_BATCH];
+    struct iovec iov[RECV_BATCH];
+    packet_t *pkt;
+    int i, n;
+
+    memset (msg, 0, sizeof (msg));
+    for (i = 0; i < RECV_BATCH; i++) {
+        iov[i].iov_base = PKTBUF (recvbuf, i);
+        iov[i].iov_len = pktsize;
+        msg[i].msg_hdr.msg_iov = &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg (c->nfd, msg, RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (opt_debug)
+            print_pkt (PKTBUF (recvbuf, 0), "recv", n);
+        if (errno != EAGAIN)
+            perror ("recvmmsg");
+        return;
+    }
+    batch_count (&recv_batches, n);
+
+    /* The connection may be destroyed by any of the packets */
+    for (i = 0; i < n && !c->delete_me; i++) {
+        pkt = PKTBUF (recvbuf, i);
+        if (opt_debug)
+            print_pkt (pkt, "recv", msg[i].msg_len);
+        rel_recvpkt (c->rel, pkt, msg[i].msg_len);
+        memset (pkt, 0xc9, msg[i].msg_len); /* for debugging */
+    }
+}
+#else /* !USE_MMSG */
+/* Receive a packet on a client's network socket */
+static void
+conn_recv (conn_t *c)
+{
+    packet_t *pkt = PKTBUF (recvbuf, 0);
+    int len = debug_recv (c->nfd, pkt, pktsize, 0, NULL);
+    if (len < 0) {
+        if (errno != EAGAIN)
+            perror ("recv");
+    }
+    else {
+        batch_count (&recv_batches, 1);
+        rel_recvpkt (c->rel, pkt, len);
+        memset (pkt, 0xc9, len); /* for debugging */
+    }
+}
+#endif /* !USE_MMSG */
+
+/* Check length and checksum before a packet may open a connection */
+static int
+pkt_valid (packet_t *pkt, size_t len)
+{
+    uint16_t sum = pkt->cksum;
+    int valid;
+
+    if (len < 8 || ntohs (pkt->len) != len)
+        return 0;
+    pkt->cksum = 0;
+    valid = cksum (pkt, len) == sum;
+    pkt->cksum = sum;
+    return valid;
+}
+
+/* Hand a packet from the server's UDP socket to the connection of its
+ * sender, creating a connection if it comes from a new peer. */
+static void
+server_demux (const struct config_common *cc,
+              const struct sockaddr_storage *from, packet_t *pkt, size_t len)
+{
+    conn_t *c = peer_lookup (from);
+
+    if (!c) {
+        if (!pkt_valid (pkt, len) || !rel_create (NULL, from, cc))
+            return;
+        c = peer_lookup (from);
+        assert (c);
+    }
+    if (!c->delete_me)
+        rel_recvpkt (c->rel, pkt, len);
+}
+
+#if USE_MMSG
+/* Receive up to RECV_BATCH packets on the server's UDP socket.
+ * Returns non-zero if there may be more. */
+static int
+server_recv (const struct config_common *cc)
+{
+    struct sockaddr_storage from[RECV_BATCH];
+    struct mmsghdr msg[RECV_BATCH];
+    struct iovec iov[RECV_BATCH];
+    int i, n;
+
+    memset (msg, 0, sizeof (msg));
+    for (i = 0; i < RECV_BATCH; i++) {
+        iov[i].iov_base = PKTBUF (recvbuf, i);
+        iov[i].iov_len = pktsize;
+        msg[i].msg_hdr.msg_iov = &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+        msg[i].msg_hdr.msg_name = &from[i];
+        msg[i].msg_hdr.msg_namelen = sizeof (from[i]);
+    }
+    n = recvmmsg (serverconf->udp_socket, msg, RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (opt_debug)
+            print_pkt (PKTBUF (recvbuf, 0), "recv", n);
+        if (errno != EAGAIN)
+            perror ("recvmmsg");
+        return 0;
+    }
+    batch_count (&recv_batches, n);
+
+    for (i = 0; i < n; i++) {
+        if (opt_debug)
+            print_pkt (PKTBUF (recvbuf, i), "recv", msg[i].msg_len);
+        server_demux (cc, &from[i], PKTBUF (recvbuf, i), msg[i].msg_len);
+    }
+    return n == RECV_BATCH;
+}
+#else /* !USE_MMSG */
+/* Receive a packet on the server's UDP socket.  Returns non-zero if
+ * there may be more. */
+static int
+server_recv (const struct config_common *cc)
+{
+    packet_t *pkt = PKTBUF (recvbuf, 0);
+    struct sockaddr_storage from;
+    int len = debug_recv (serverconf->udp_socket, pkt, pktsize, 0, &from);
+    if (len < 0) {
+        if (errno != EAGAIN)
+            perror ("recvfrom");
+        return 0;
+    }
+    batch_count (&recv_batches, 1);
+    server_demux (cc, &from, pkt, len);
+    return 1;
+}
+#endif /* !USE_MMSG */
+
+/* All peers share the server's UDP socket, so it is drained further than
+ * other sockets (up to SERVER_RECV_ROUNDS calls) before anything else
+ * runs, lest it overflows. */
+static void
+server_drain (const struct config_common *cc)
+{
+    int i;
+    for (i = 0; i < SERVER_RECV_ROUNDS && server_recv (cc); i++)
+        ;
+}
+
+#if USE_EPOLL
+
+static void
+conn_dirty (conn_t *c)
+{
+    if (c->dprev)
+        return;
+    c->dprev = &evdirty;
+    c->dnext = evdirty;
+    if (evdirty)
+        evdirty->dprev = &c->dnext;
+    evdirty = c;
+}
+
+/* Register e->fd for the events want, or unregister it if want is -1.
+ * Regular files can't be registered with epoll; they are always ready,
+ * so instead an event is appended to ready[*nready] whenever they are
+ * wanted. */
+static void
+evreg_sync (struct evreg *e, int want, struct epoll_event *ready,
+            int *nready)
+{
+    struct epoll_event ev;
+
+    if (e->dead)
+        want = -1;
+    if (e->nopoll) {
+        if (want > 0 && ready && *nready < EV_MAX) {
+            ready[*nready].events = want;
+            ready[(*nready)++].data.ptr = e;
+        }
+        return;
+    }
+    if (want == e->events)
+        return;
+
+    if (want < 0) {
+        if (epoll_ctl (epfd, EPOLL_CTL_DEL, e->fd, NULL) < 0)
+            perror ("epoll_ctl");
+        e->events = -1;
+        return;
+    }
+    ev.events = want;
+    ev.data.ptr = e;
+    if (epoll_ctl (epfd, e->events < 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+                   e->fd, &ev) < 0) {
+        if (errno == EPERM) {
+            e->nopoll = 1;
+            evreg_sync (e, want, ready, nready);
+        }
+        else {
+            perror ("epoll_ctl");
+            e->dead = 1;
+        }
+        return;
+    }
+    e->events = want;
+}
+
+/* Bring the registrations of a connection in line with its state */
+static void
+conn_sync (conn_t *c, struct epoll_event *ready, int *nready)
+{
+    int rd = -1, wr = -1, n = -1;
+
+    if (!c->read_eof && !c->delete_me)
+        rd = c->xoff ? 0 : EPOLLIN;
+    if (!c->write_err)
+        wr = c->outqlen ? EPOLLOUT : 0;
+    if (!c->server && !c->delete_me)
+        n = EPOLLIN;
+
+    if (c->rev.events < 0)
+        c->rev.fd = c->rfd;
+    if (c->wev.events < 0)
+        c->wev.fd = c->wfd;
+    if (c->nev.events < 0)
+        c->nev.fd = c->nfd;
+
+    if (c->wfd == c->rfd) {
+        if (rd >= 0 || wr >= 0)
+            rd = (rd > 0 ? rd : 0) | (wr > 0 ? wr : 0);
+        wr = -1;
+    }
+    evreg_sync (&c->rev, rd, ready, nready);
+    evreg_sync (&c->wev, wr, ready, nready);
+    evreg_sync (&c->nev, n, ready, nready);
+
+    /* Ready regular files have to be handled again next time */
+    if ((c->rev.nopoll && rd > 0) || (c->wev.nopoll && wr > 0))
+        conn_dirty (c);
+}
+
+/* Have the socket of a blocked send queue polled for EPOLLOUT as well,
+ * and no longer once it is not blocked */
+static void
+sendq_arm (void)
+{
+    struct evreg *e = NULL;
+    conn_t *c;
+
+    if (sendq.blocked) {
+        if (serverconf && sendq.fd == evudp.fd)
+            e = &evudp;
+        for (c = conn_list; c && !e; c = c->next)
+            if (!c->server && c->nfd == sendq.fd)
+                e = &c->nev;
+    }
+    if (evsendq && evsendq != e && evsendq->events > 0)
+        evreg_sync (evsendq, evsendq->events & ~EPOLLOUT, NULL, NULL);
+    evsendq = NULL;
+    if (e && e->events > 0) {
+        evreg_sync (e, e->events | EPOLLOUT, NULL, NULL);
+        evsendq = e;
+    }
+}
+
+/* Create the epoll instance */
+static void
+conn_mkevents (void)
+{
+    if (epfd >= 0)
+        return;
+    if ((epfd = epoll_create1 (EPOLL_CLOEXEC)) < 0) {
+        perror ("epoll_create1");
+        exit (1);
+    }
+    everr.fd = 2;			/* Do catch errors on stderr */
+    everr.events = -1;
+    evreg_sync (&everr, 0, NULL, NULL);
+    if (serverconf) {
+        evudp.fd = serverconf->udp_socket;
+        evudp.events = -1;
+        evreg_sync (&evudp, EPOLLIN, NULL, NULL);
+    }
+}
+
+static void
+evreg_ready (struct evreg *e, uint32_t events,
+             const struct config_common *cc)
+{
+    conn_t *c = e->conn;
+
+    if (e == &evudp) {
+        if (events & EPOLLOUT)
+            sendq_flush ();
+        if (events & EPOLLIN)
+            server_drain (cc);
+        return;
+    }
+    if (events & (EPOLLHUP|EPOLLERR)) {
+        /* If stderr has an error, the tester has probably died, so exit
+        * immediately. */
+        if (!c)
+            exit (1);
+        e->dead = 1;
+        conn_dirty (c);
+    }
+    if (!c)
+        return;
+
+    if (e == &c->nev) {
+        if (c->delete_me)
+            return;
+        if (events & EPOLLOUT)
+            sendq_flush ();
+        if (events & (EPOLLERR|EPOLLHUP))
+            conn_unreachable (c, cc);
+        else if (events & EPOLLIN)
+            conn_recv (c);
+        return;
+    }
+    if (e == &c->rev && !c->delete_me && !c->read_eof
+            && (events & (EPOLLIN|EPOLLERR|EPOLLHUP))) {
+        c->xoff = 1;
+        conn_dirty (c);
+        rel_read (c->rel);
+    }
+    if ((e == &c->wev || c->wfd == c->rfd)
+            && (events & (EPOLLOUT|EPOLLHUP|EPOLLERR)))
+        conn_drain (c);
+}
+
+static void
+conn_wait (const struct config_common *cc)
+{
+    struct epoll_event ev[EV_MAX];
+    conn_t *c, *dirty;
+    int i, n = 0, r = 0;
+
+    if (epfd < 0)
+        conn_mkevents ();
+
+    dirty = evdirty;
+    evdirty = NULL;
+    if (dirty)
+        dirty->dprev = &dirty;
+    while ((c = dirty)) {
+        dirty = c->dnext;
+        if (dirty)
+            dirty->dprev = &dirty;
+        c->dprev = NULL;
+        conn_sync (c, ev, &n);
+    }
+    sendq_arm ();
+
+    /* Sleep until I/O happens or the next timer is due, unless a
+     * regular file is ready already */
+    if (n < EV_MAX) {
+        r = epoll_wait (epfd, ev + n, EV_MAX - n, n ? 0 : rel_timer_in ());
+        if (r < 0) {
+            if (errno != EINTR)
+                perror ("epoll_wait");
+            r = 0;
+        }
+    }
+
+    for (i = 0; i < n + r; i++)
+        evreg_ready (ev[i].data.ptr, ev[i].events, cc);
+}
+
+#else /* !USE_EPOLL */
+
 static void
 conn_mkevents (void)
 {
@@ -409,8 +1215,10 @@ conn_mkevents (void)
 
     e = xmalloc (n * sizeof (*e));
     memset (e, 0, n * sizeof (*e));
-    if (cevents)
-        e[0] = cevents[0];
+    if (serverconf) {
+        e[0].fd = serverconf->udp_socket;
+        e[0].events = POLLIN;
+    }
     else
         e[0].fd = -1;
     e[1].fd = 2;			/* Do catch errors on stderr */
@@ -423,7 +1231,7 @@ conn_mkevents (void)
         }
         if (c->wpoll) {
             e[c->wpoll].fd = c->wfd;
-            if (c->outq)
+            if (c->outqlen)
                 e[c->wpoll].events |= POLLOUT;
         }
         if (c->npoll) {
@@ -454,38 +1262,40 @@ conn_mkevents (void)
     evwriters = w;
 }
 
-long
-need_timer_in (const struct timespec *last, long timer)
-{
-    long to;
-    struct timespec ts;
-
-    clock_gettime (CLOCK_MONOTONIC, &ts);
-    to = ts.tv_sec - last->tv_sec;
-    if (to > timer / 1000)
-        return 0;
-    to = to * 1000 + (ts.tv_nsec - last->tv_nsec) / 1000000;
-    if (to >= timer)
-        return 0;
-    return timer - to;
-}
-
-void
-conn_poll (const struct config_common *cc)
+static void
+conn_wait (const struct config_common *cc)
 {
-    int i;
-    conn_t *c, *nc;
-    static int last_cg;
+    int i, out = -1;
+    conn_t *c;
+    static THREAD_LOCAL int last_cg;
 
     if (last_cg != cevents_generation) {
         conn_mkevents ();
         cevents_generation = last_cg;
     }
 
+    /* Packets the socket did not take wait for it to become writable */
+    if (sendq.blocked)
+        for (i = 0; i < ncevents && out < 0; i++)
+            if (cevents[i].fd == sendq.fd && (i == 0 || evreaders[i])) {
+                cevents[i].events |= POLLOUT;
+                out = i;
+            }
+
+    /* Sleep until I/O happens or the next timer is due */
     if (cevents[0].fd >= 0)
-        poll (cevents, ncevents, need_timer_in (&last_timeout, cc->timer));
+        poll (cevents, ncevents, rel_timer_in ());
     else
-        poll (cevents+1, ncevents-1, need_timer_in (&last_timeout, cc->timer));
+        poll (cevents+1, ncevents-1, rel_timer_in ());
+
+    if (out >= 0) {
+        cevents[out].events &= ~POLLOUT;
+        if (cevents[out].revents & POLLOUT)
+            sendq_flush ();
+    }
+    if (cevents[0].revents & POLLIN)
+        server_drain (cc);
+    cevents[0].revents = 0;
 
     for (i = 1; i < ncevents; i++) {
         if (cevents[i].revents & (POLLIN|POLLERR|POLLHUP)) {
@@ -496,30 +1306,10 @@ conn_poll (const struct config_common *cc)
                     rel_read (c->rel);
                 }
                 else if (cevents[i].fd == c->nfd
-                         && (cevents[i].revents & (POLLERR|POLLHUP))) {
-                    char addr[NI_MAXHOST] = "unknown";
-                    char port[NI_MAXSERV] = "unknown";
-                    getnameinfo ((const struct sockaddr *) &c->peer, sizeof (c->peer),
-                    addr, sizeof (addr), port, sizeof (port),
-                    NI_DGRAM | NI_NUMERICHOST|NI_NUMERICSERV);
-                    fprintf (stderr, "[received ICMP port unreachable;"
-                    " assuming peer at %s:%s is dead]\n", addr, port);
-                    if (cc->single_connection)
-                    exit (1);
-                    rel_destroy (c->rel);
-                }
-                else if (cevents[i].fd == c->nfd && !c->server) {
-                    packet_t pkt;
-                    int len = debug_recv (c->nfd, &pkt, sizeof (pkt), 0, NULL);
-                    if (len < 0) {
-                        if (errno != EAGAIN)
-                            perror ("recv");
-                    }
-                    else {
-                        rel_recvpkt (c->rel, &pkt, len);
-                        memset (&pkt, 0xc9, len); /* for debugging */
-                    }
-                }
+                         && (cevents[i].revents & (POLLERR|POLLHUP)))
+                    conn_unreachable (c, cc);
+                else if (cevents[i].fd == c->nfd && !c->server)
+                    conn_recv (c);
             }
         }
         if ((cevents[i].revents & (POLLOUT|POLLHUP|POLLERR))
@@ -538,15 +1328,30 @@ conn_poll (const struct config_common *cc)
         }
         cevents[i].revents = 0;
     }
+}
 
-    if (need_timer_in (&last_timeout, cc->timer) == 0) {
+#endif /* !USE_EPOLL */
+
+void
+conn_poll (const struct config_common *cc)
+{
+    conn_t *c, *nc;
+
+    /* Packets queued outside the loop, e.g. by rel_create */
+    sendq_flush ();
+
+    conn_wait (cc);
+
+    if (rel_timer_in () == 0)
         rel_timer ();
-        clock_gettime (CLOCK_MONOTONIC, &last_timeout);
-    }
 
+    sendq_flush ();
+
+    if (!ndeleted)
+        return;
     for (c = conn_list; c; c = nc) {
         nc = c->next;
-        if (c->delete_me && (c->write_err || !c->outq))
+        if (c->delete_me && (c->write_err || !c->outqlen))
             conn_free (c);
     }
 }
@@ -554,17 +1359,7 @@ conn_poll (const struct config_common *cc)
 uint16_t
 cksum (const void *_data, int len)
 {
-    const uint8_t *data = _data;
-    uint32_t sum;
-
-    for (sum = 0;len >= 2; data += 2, len -= 2)
-        sum += data[0] << 8 | data[1];
-    if (len > 0)
-        sum += data[0] << 8;
-    while (sum > 0xffff)
-        sum = (sum >> 16) + (sum & 0xffff);
-    sum = htons (~sum);
-    return sum ? sum : 0xffff;
+    return cksum_impl (_data, len);
 }
 
 int
@@ -725,8 +1520,10 @@ int dgram, int family, char *name)
     return 0;
 }
 
-int
-listen_on (int dgram, struct sockaddr_storage *ss)
+/* listen_on, optionally with SO_REUSEPORT so that several sockets can
+ * share the port and the kernel spreads peers across them */
+static int
+listen_on_opt (int dgram, struct sockaddr_storage *ss, int reuseport)
 {
     int type = dgram ? SOCK_DGRAM : SOCK_STREAM;
     int s = socket (ss->ss_family, type, 0);
@@ -741,6 +1538,12 @@ listen_on (int dgram, struct sockaddr_storage *ss)
     }
     if (!dgram)
         setsockopt (s, SOL_SOCKET, SO_REUSEADDR, (char *) &n, sizeof (n));
+    if (reuseport
+            && setsockopt (s, SOL_SOCKET, SO_REUSEPORT, &n, sizeof (n)) < 0) {
+        perror ("SO_REUSEPORT");
+        close (s);
+        return -1;
+    }
     if (bind (s, (const struct sockaddr *) ss, addrsize (ss)) < 0) {
         perror ("bind");
         close (s);
@@ -779,6 +1582,12 @@ listen_on (int dgram, struct sockaddr_storage *ss)
     return s;
 }
 
+int
+listen_on (int dgram, struct sockaddr_storage *ss)
+{
+    return listen_on_opt (dgram, ss, 0);
+}
+
 int
 connect_to (int dgram, const struct sockaddr_storage *ss)
 {
@@ -799,6 +1608,7 @@ connect_to (int dgram, const struct sockaddr_storage *ss)
     return s;
 }
 
+#if !USE_MMSG
 static int
 debug_recv (int s, packet_t *buf, size_t len, int flags,
 struct sockaddr_storage *from)
@@ -813,28 +1623,80 @@ struct sockaddr_storage *from)
         print_pkt (buf, "recv", n);
     return n;
 }
+#endif /* !USE_MMSG */
+
+/* Event loop of a server thread */
+static void *
+server_loop (void *arg)
+{
+    serverconf = arg;
+    pktbuf_init (serverconf->c.mss);
+    conn_mkevents ();
+    for (;;)
+        conn_poll (&serverconf->c);
+    return NULL;
+}
 
 static void
 usage (void)
 {
     fprintf (stderr,
-                "usage: %s udp-port [host:]udp-port\n"
-                , progname);
+                "usage: %s [-c] udp-port [host:]udp-port\n"
+                "       %s -s [-u] [--threads n] udp-port {[host:]tcp-port | unix-path}\n"
+                , progname, progname);
     exit (1);
 }
 
+/* Parse the argument of a numeric option, which has to be a number
+ * from min to max and nothing else */
+static long long
+num_arg (const char *arg, int base, long long min, long long max)
+{
+    char *end;
+    long long n;
+
+    errno = 0;
+    n = strtoll (arg, &end, base);
+    if (end == arg || *end != '\0' || errno || n < min || n > max) {
+        fprintf (stderr, "%s: invalid number: %s\n", progname, arg);
+        usage ();
+    }
+    return n;
+}
+
 int
 main (int argc, char **argv)
 {
     struct option o[] = {
         { "debug", no_argument, NULL, 'd' },
         { "window", required_argument, NULL, 'w' },
+        { "rto-min", required_argument, NULL, 'm' },
+        { "rto-max", required_argument, NULL, 'M' },
+        { "sack", no_argument, NULL, 'S' },
+        { "rwnd", no_argument, NULL, 'R' },
+        { "tlp", no_argument, NULL, 'L' },
+        { "stats", no_argument, NULL, 'T' },
+        { "cc", required_argument, NULL, 'C' },
+        { "pace", no_argument, NULL, 'P' },
+        { "threads", required_argument, NULL, 'N' },
+        { "outbuf", required_argument, NULL, 'O' },
+        { "nagle", required_argument, NULL, 'G' },
+        { "delack", required_argument, NULL, 'D' },
+        { "isn", required_argument, NULL, 'I' },
+        { "mss", required_argument, NULL, 'Z' },
+        { "fec", required_argument, NULL, 'F' },
+        { "streams", required_argument, NULL, 'X' },
         { NULL, 0, NULL, 0 }
     };
-    int opt;
+    int opt, n, i;
+    int opt_server = 0;
+    int opt_unix = 0;
+    int nthreads = 1;
     char *local = NULL;
     char *remote = NULL;
     struct config_common c;
+    struct config_server *sc;
+    pthread_t tid;
     struct sigaction sa;
 
     /* Ignore SIGPIPE, since we may get a lot of these */
@@ -842,9 +1704,17 @@ main (int argc, char **argv)
     sa.sa_handler = SIG_IGN;
     sigaction (SIGPIPE, &sa, NULL);
 
+    cksum_impl = cksum_select ()->fn;
+
     memset (&c, 0, sizeof (c));
     c.window = 1;
     c.timeout = 2000;
+    c.rto_min = 10;
+    c.rto_max = 60000;
+    c.outbuf = -1;
+    c.mss = PACKET_DATA_DEFAULT;
+    c.cc_algorithm = "none";
+    c.isn = 1;
 
     progname = strrchr (argv[0], '/');
     if (progname)
@@ -854,6 +1724,15 @@ main (int argc, char **argv)
 
     while ((opt = getopt_long (argc, argv, "cdust:w:l", o, NULL)) != -1)
         switch (opt) {
+        case 'c':
+            opt_server = 0;
+            break;
+        case 's':
+            opt_server = 1;
+            break;
+        case 'u':
+            opt_unix = 1;
+            break;
         case 'd':
             opt_debug = 1;
             break;
@@ -871,29 +1750,127 @@ main (int argc, char **argv)
             }
             break;
         case 'w':
-            c.window = atoi (optarg);
+            c.window = num_arg (optarg, 10, 1, WINDOW_MAX);
             break;
         case 't':
-            c.timeout = atoi (optarg);
+            c.timeout = num_arg (optarg, 10, INT_MIN, INT_MAX);
+            break;
+        case 'm':
+            c.rto_min = num_arg (optarg, 10, INT_MIN, INT_MAX);
+            break;
+        case 'M':
+            c.rto_max = num_arg (optarg, 10, INT_MIN, INT_MAX);
+            break;
+        case 'S':
+            c.sack = 1;
+            break;
+        case 'R':
+            c.rwnd = 1;
+            break;
+        case 'L':
+            c.tlp = 1;
+            break;
+        case 'T':
+            c.stats = 1;
+            break;
+        case 'C':
+            c.cc_algorithm = optarg;
+            break;
+        case 'P':
+            c.pace = 1;
+            break;
+        case 'N':
+            nthreads = num_arg (optarg, 10, INT_MIN, INT_MAX);
+            break;
+        case 'O':
+            c.outbuf = num_arg (optarg, 10, INT_MIN, INT_MAX);
+            break;
+        case 'G':
+            c.nagle = num_arg (optarg, 10, INT_MIN, INT_MAX);
+            break;
+        case 'D':
+            c.delack = num_arg (optarg, 10, INT_MIN, INT_MAX);
+            break;
+        case 'I':
+            c.isn = num_arg (optarg, 0, 1, UINT32_MAX);
+            break;
+        case 'Z':
+            c.mss = num_arg (optarg, 10, INT_MIN, INT_MAX);
+            break;
+        case 'F':
+            c.fec = num_arg (optarg, 10, INT_MIN, INT_MAX);
+            break;
+        case 'X':
+            c.streams = num_arg (optarg, 10, INT_MIN, INT_MAX);
             break;
         default:
             usage ();
             break;
         }
 
-    if (optind + 2 != argc || c.window < 1 || c.timeout < 10) {
+    if (c.window < 1 || c.mss < PACKET_DATA_DEFAULT || c.mss > PACKET_DATA_MAX)
+        usage ();
+    /* A window of full packets, which can exceed an int */
+    if (c.outbuf == -1) {
+        long long n = (long long) c.window * c.mss;
+        c.outbuf = n < 8192 ? 8192 : n > INT_MAX ? INT_MAX : n;
+    }
+    if (optind + 2 != argc || c.timeout < 10
+            || c.rto_min < 1 || c.rto_max < c.rto_min
+            || c.outbuf < c.mss
+            || c.nagle < 0 || c.delack < 0 || c.isn == 0
+            || c.fec < 0 || c.fec > 64
+            || c.streams < 0 || c.streams > 1024
+            || !cc_find (c.cc_algorithm) || (opt_unix && !opt_server)
+            || nthreads < 1 || (nthreads > 1 && !opt_server)) {
         usage ();
     }
 
-    c.timer = c.timeout / 5;
     local = argv[optind];
     remote = argv[optind+1];
 
+    /* Server: every peer sending to the UDP port gets its own
+     * connection to the stream socket at remote.  With several
+     * threads, each has its own socket bound to the port (the first
+     * one resolves a port of 0) and the kernel assigns every peer to
+     * one of them, so a thread owns its peers' connections and
+     * timers. */
+    if (opt_server) {
+        struct sockaddr_storage sl;
+        sc = xmalloc (nthreads * sizeof (*sc));
+        memset (sc, 0, nthreads * sizeof (*sc));
+        if (get_address (&sc[0].dest, 0, 0, opt_unix ? AF_UNIX : AF_INET,
+                         remote) < 0
+                || get_address (&sl, 1, 1, AF_INET, local) < 0)
+            exit (1);
+        for (i = 0; i < nthreads; i++) {
+            sc[i].c = c;
+            sc[i].dest = sc[0].dest;
+            if ((sc[i].udp_socket = listen_on_opt (1, &sl, nthreads > 1)) < 0)
+                exit (1);
+            make_async (sc[i].udp_socket);
+            /* The windows of all peers share one socket buffer */
+            n = SERVER_RCVBUF;
+            setsockopt (sc[i].udp_socket, SOL_SOCKET, SO_RCVBUF,
+                        &n, sizeof (n));
+        }
+
+        for (i = 1; i < nthreads; i++)
+            if ((n = pthread_create (&tid, NULL, server_loop, &sc[i]))) {
+                fprintf (stderr, "pthread_create: %s\n", strerror (n));
+                exit (1);
+            }
+        server_loop (&sc[0]);
+    }
+
     struct sockaddr_storage sl, sr;
+    int rcvbuf;
+    socklen_t optlen = sizeof (rcvbuf);
     conn_t *cn = conn_alloc ();
     c.single_connection = 1;
     cn->rfd = 0;
     cn->wfd = 1;
+    cn->outbuf = c.outbuf;
     if (get_address (&sr, 0, 1, AF_INET, remote) < 0
             || get_address (&sl, 1, 1, sr.ss_family, local) < 0
             || (cn->nfd = listen_on (1, &sl)) < 0)
@@ -902,16 +1879,32 @@ main (int argc, char **argv)
         perror ("connect");
         exit (1);
     }
+    /* A window of the largest packets has to fit into the socket buffer
+     * (the kernel doubles requests for its bookkeeping, and reports the
+     * doubled size) */
+    n = (long long) c.window * (c.mss + 12) > INT_MAX / 2
+        ? INT_MAX / 2 : c.window * (c.mss + 12);
+    if (getsockopt (cn->nfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen) == 0
+            && rcvbuf < 2 * n)
+        setsockopt (cn->nfd, SOL_SOCKET, SO_RCVBUF, &n, sizeof (n));
     cn->server = 0;
     cn->peer = sr;
     make_async (cn->rfd);
     make_async (cn->wfd);
     make_async (cn->nfd);
+    pktbuf_init (c.mss);
     cn->rel = rel_create (cn, NULL, &c);
 
     conn_mkevents ();
     while (conn_list)
         conn_poll (&c);
 
+    if (c.stats || opt_debug) {
+        fprintf (stderr, "[batches: ");
+        batch_print ("recv", &recv_batches);
+        batch_print ("; send", &send_batches);
+        fprintf (stderr, "]\n");
+    }
+
     return 0;
 }
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 /* -----------------------------------------------------------------------
 
@@ -14,7 +15,8 @@
 
    There are two kinds of packets, Data packets and Ack-only packets.
    You can tell the type of a packet by length.  Ack packets are 8
-   bytes, while Data packets vary from 12 to 512 bytes.
+   bytes, while Data packets vary from 12 to 512 bytes (or to 12 plus
+   a larger maximum payload both sides agreed on, see mss below).
 
    Every Data packet contains a 32-bit sequence number as well as 0 or
    more bytes of payload.
@@ -74,12 +76,16 @@ struct ack_packet {
     uint32_t ackno;
 };
 
+#define PACKET_DATA_DEFAULT 500	/* Payload of a full Data packet */
+#define PACKET_DATA_MAX 8960	/* Largest payload --mss allows (9000-byte MTU) */
+#define WINDOW_MAX 16384	/* Largest window -w allows (packets) */
+
 struct packet {
     uint16_t cksum;
     uint16_t len;
     uint32_t ackno;
     uint32_t seqno;		/* Only valid if length > 8 */
-    char data[500];
+    char data[PACKET_DATA_MAX];
 };
 typedef struct packet packet_t;
 
@@ -91,18 +97,23 @@ typedef struct packet packet_t;
 
      <local-IP-address, local-UDP-port, remote-IP-address, remote-UDP-port>
 
-     In stand-alone mode, and in the client, the task of connection
-     demultiplexing is handled automatically for you.  In server
-     mode, you must demultiplex packets yourself.  A useful function
-     for this is addreq(), which compares two sockaddr_storage
-     structures and tells you if they are the same.
+     The task of connection demultiplexing is handled automatically
+     for you.  In server mode (-s), all peers send to one UDP port; the
+     library looks up the connection of each datagram's sender in a
+     hash table (addrhash() and addreq() on the peer address) and
+     calls rel_create with a NULL conn_t for every new peer, which
+     opens a stream connection to the server's destination address
+     (TCP, or a unix-domain socket with -u).
 
    * The configuration of the program is described by a structure
      config_common that gets passed to various functions.  The most
      important fields are:
 
        - window:  Tells you the size of the sliding window (which will
-                  be 1 for stop-and-wait).
+                  be 1 for stop-and-wait, at most WINDOW_MAX).  Each
+                  connection allocates room for two windows of full
+                  packets up front, and sequence numbers compare
+                  correctly only across less than 2^31 of them.
 
        - timeout: Tells you what your retransmission timer should be,
                   in milliseconds.  If after this many milliseconds a
@@ -112,10 +123,97 @@ typedef struct packet packet_t;
                   CLOCK_MONOTONIC useful for keeping track of when
                   packets are sent.  Run "man clock_gettime".
 
-   * Your task is to implement the following six functions:
+                  The timeout is only the initial value: it adapts to
+                  the measured round-trip time, within the bounds
+                  rto_min and rto_max.
+
+       - cc_algorithm:
+                  Name of the congestion control algorithm limiting
+                  the packets in flight below the window (--cc, see
+                  cc.h). "none" keeps the whole window in flight.
+
+       - pace:    Spread new packets evenly over the round-trip time
+                  instead of sending the window back to back (--pace).
+
+       - sack:    Offer selective acknowledgements to the peer
+                  (--sack, see ext.h).
+
+       - rwnd:    Offer receive window advertisement to the peer
+                  (--rwnd, see ext.h): the sender keeps within the
+                  free output space of the receiver and probes a
+                  closed window instead of retransmitting into it.
+
+       - tlp:     Send a tail loss probe (--tlp): when no
+                  acknowledgement has come for two smoothed round-trip
+                  times while packets are in flight, and their
+                  retransmission timeout is further out, resend the
+                  newest of them.  A lost packet at the end of a burst
+                  is repaired that way, and a duplicate acknowledgement
+                  of the probe fast-retransmits the oldest one,
+                  without waiting for the timeout.
+
+       - stats:   Print transfer statistics when the connection is
+                  destroyed (--stats).
+
+       - outbuf:  How many bytes of output conn_output buffers per
+                  connection when the output can't keep up, which is
+                  what conn_bufspace reports (--outbuf, by default
+                  a window of full packets but at least 8192, at
+                  least one packet's payload).
+
+       - nagle:   Hold back a short Data packet while another short
+                  one is unacknowledged, so that small writes
+                  coalesce as described above, but never for more
+                  than this many milliseconds (--nagle ms, 0 = off,
+                  the default).
+
+       - delack:  Acknowledge in-order Data packets in pairs, or this
+                  many milliseconds after the first of a pair,
+                  whichever comes first (--delack ms, 0 = off, the
+                  default).  Out-of-order packets, duplicates, short
+                  packets and EOF are still acknowledged right away.
+                  Off with a window of 1, where the second packet of
+                  a pair cannot be sent before the first is
+                  acknowledged.
+
+       - mss:     Largest payload of a Data packet (--mss, 500 by
+                  default, up to PACKET_DATA_MAX).  More than 500 is
+                  offered to the peer (see ext.h) and only used once
+                  it agrees; on a client it is also limited to what
+                  fits the path MTU the kernel knows (conn_mtu).
+
+       - isn:     Sequence number of the first Data packet (--isn n,
+                  1 by default, never 0).  Sequence numbers wrap
+                  around after 2^32 - 1 to 1 and are compared as
+                  serial numbers (see seq.h).  Both sides must use the
+                  same value, which is mainly useful to start a
+                  transfer right before the wrap.
+
+       - fec:     Send the XOR parity of every group of this many
+                  Data packets, from which the peer rebuilds one lost
+                  packet per group without waiting for it to be
+                  retransmitted (--fec k, 0 = off, the default, up to
+                  64; see fec.h).  The overhead is one packet in k.
+                  Offered to the peer (see ext.h) and only used once
+                  it agrees, which it does with any --fec of its own.
+
+       - streams: Carry this many independent streams in the
+                  connection (--streams n, 0 = off, the default, up
+                  to 1024).  The input and output are then sequences
+                  of frames: a 16-bit big-endian stream number below
+                  n, a 16-bit big-endian length and that many bytes
+                  of the stream.  Each stream arrives in order, but a
+                  lost packet only holds up the stream it belongs to:
+                  packets of other streams behind it are written out
+                  right away, so frames of different streams may be
+                  reordered.  Sequence numbers, acknowledgements and
+                  retransmissions stay shared.  Both sides must use
+                  the same value.
+
+   * Your task is to implement the following seven functions:
 
        rel_create, rel_destroy, rel_recvpkt,
-       rel_read, rel_output, rel_timer
+       rel_read, rel_output, rel_timer, rel_timer_in
 
      as well to augment the reliable_state data structure.  All the
      changes you need to make are in the file reliable.c.
@@ -167,9 +265,10 @@ typedef struct packet packet_t;
      point you can send out more Acks to get more data from the remote
      side.
 
-   * The function rel_timer is called periodically, currently at a
-     rate 1/5 of the retransmission interval.  You can use this timer
-     to inspect packets and retransmit packets that have not been
+   * The function rel_timer is called whenever the time reported by
+     rel_timer_in has passed; the library sleeps until then (or until
+     some I/O happens) and never calls rel_timer otherwise.  You can
+     use this timer to retransmit packets that have not been
      acknowledged.  Do not retransmit every packet every time the
      timer is fired!  You must keep track of which packets need to be
      retransmitted when.
@@ -178,13 +277,32 @@ typedef struct packet packet_t;
 
 struct config_common {
     int window;			/* # of unacknowledged packets in flight */
-    int timer;			/* How often rel_timer called in milliseconds */
-    int timeout;			/* Retransmission timeout in milliseconds */
+    int timeout;			/* Initial retransmission timeout in milliseconds */
+    int rto_min;			/* Lower bound of the adaptive timeout (ms) */
+    int rto_max;			/* Upper bound of the adaptive timeout (ms) */
+    const char *cc_algorithm;	/* Congestion control: none, reno, cubic, bbr */
+    int pace;			/* Pace new packets over the RTT */
+    int sack;			/* Negotiate selective acknowledgements */
+    int rwnd;			/* Negotiate receive window advertisement */
+    int tlp;			/* Send tail loss probes */
+    int stats;			/* Print statistics on rel_destroy */
+    int outbuf;			/* Output buffered per connection (bytes) */
+    int nagle;			/* Hold short packets up to this many ms, 0: off */
+    int delack;			/* Delay ACKs up to this many ms, 0: off */
+    uint32_t isn;			/* Sequence number of the first Data packet */
+    int mss;			/* Largest Data packet payload (bytes) */
+    int fec;			/* Parity packet per this many Data packets, 0: off */
+    int streams;			/* Independent framed streams, 0: off */
     int single_connection;        /* Exit after first connection failure */
 };
 
 typedef struct reliable_state rel_t;
 
+/* Event loop state (connections, timers) is kept per thread: every
+ * worker thread of a multi-threaded server (--threads) runs its own
+ * event loop over its own connections. */
+#define THREAD_LOCAL __thread
+
 extern char *progname;		/* Set to name of program by main */
 extern int opt_debug;		/* When != 0, print packets */
 
@@ -229,16 +347,24 @@ typedef struct conn conn_t;
 conn_t *conn_create (rel_t *, const struct sockaddr_storage *);
 
 /**
- * Call this function to send a UDP packet to the other side.
+ * Call this function to send a UDP packet to the other side.  The
+ * packet is copied into a queue that is sent in one batch at the end
+ * of the current event loop iteration; errors are only reported with
+ * -d.
  *
  * @param   pkt      Pointer to packet to be sent
  *
  * @param   len      Length of the packet
  *
- * @return  number of bytes sent if successfull, -1 otherwise
+ * @return  number of bytes queued
  */
 int conn_sendpkt (conn_t *c, const packet_t *pkt, size_t len);
 
+/* The path MTU the kernel knows for the connection's peer (the MTU of
+ * the route, lowered by ICMP "fragmentation needed" messages), or 0 if
+ * unknown, e.g. in server mode where all peers share one socket. */
+int conn_mtu (conn_t *c);
+
 /* This function tells you how many bytes of output buffering are free
  * for conn_output to store your data.  conn_output is guaranteed not
  * to return 0 if you write less than this many bytes. */
@@ -262,6 +388,20 @@ size_t conn_bufspace (conn_t *c);
  **/
 int conn_output (conn_t *c, const void *buf, size_t len);
 
+/* Like conn_output, but writes the iovcnt buffers of iov in order, in
+ * a single writev if nothing is queued.  Use it to hand several
+ * packets to the output at once.  Either all of the bytes are written
+ * or queued, or, if conn_bufspace is 0, none (returns 0).  Cannot
+ * send EOF; call conn_output with len == 0 for that.
+ *
+ * @param   iov      Buffers to be written to output, in order
+ *
+ * @param   iovcnt   Number of buffers in iov
+ *
+ * @return  number of bytes written or queued, or -1 on error
+ **/
+int conn_outputv (conn_t *c, const struct iovec *iov, int iovcnt);
+
 /* Get some input from the reliable side.  You must must then put the
  * data into UDP sockets which you send out with conn_sendpkt.  This
  * function returns the number of bytes received, 0 if there is no
@@ -282,13 +422,15 @@ rel_t *rel_create (conn_t *, const struct sockaddr_storage *,
 		   const struct config_common *);
 void rel_destroy (rel_t *);
 
-/* This function gets called on clients, when packets arrive: */
+/* This function gets called when packets arrive.  On servers, packets
+ * are demultiplexed by the address of the peer they come from. */
 void rel_recvpkt (rel_t *, packet_t *pkt, size_t len);
 
 /* Notification handlers */
 void rel_read (rel_t *);    /* Invoked when you can call conn_input */
 void rel_output (rel_t *);  /* Invoked when some output drained */
-void rel_timer (void); /* Invoked roughly each timer/5 milliseconds */
+void rel_timer (void); /* Invoked when rel_timer_in has counted down */
+long rel_timer_in (void); /* Milliseconds until rel_timer is due (-1: never) */
 
 
 
@@ -0,0 +1,126 @@
+#include "rtt.h"
+
+/**
+ * Clamp the RTO to its configured bounds.
+ *
+ * @param   rtt         Pointer to estimator
+*/
+static void rtt_clamp(rtt_t *rtt) {
+    if (rtt->rto < rtt->rto_min) {
+        rtt->rto = rtt->rto_min;
+    } else if (rtt->rto > rtt->rto_max) {
+        rtt->rto = rtt->rto_max;
+    }
+}
+
+/**
+ * Initialize the estimator.
+ *
+ * @param   rtt         Pointer to estimator
+ * @param   initial_rto RTO to use until the first sample (ms)
+ * @param   rto_min     Lower bound of the RTO (ms)
+ * @param   rto_max     Upper bound of the RTO (ms)
+*/
+void rtt_init(rtt_t *rtt, long initial_rto, long rto_min, long rto_max) {
+    rtt->srtt8 = 0;
+    rtt->rttvar4 = 0;
+    rtt->rto_min = rto_min;
+    rtt->rto_max = rto_max;
+    rtt->rto = initial_rto;
+    rtt->backoff = 0;
+    rtt->has_sample = 0;
+    rtt_clamp(rtt);
+}
+
+/**
+ * Feed a round-trip time sample of a packet that was never retransmitted and recompute the RTO.
+ *
+ * @param   rtt         Pointer to estimator
+ * @param   sample      Measured round-trip time (ms)
+*/
+void rtt_sample(rtt_t *rtt, long sample) {
+    if (sample < 0) {
+        sample = 0;
+    }
+
+    if (!rtt->has_sample) {
+        // SRTT = R, RTTVAR = R/2
+        rtt->srtt8 = sample << 3;
+        rtt->rttvar4 = sample << 1;
+        rtt->has_sample = 1;
+    } else {
+        // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+        long delta = sample - (rtt->srtt8 >> 3);
+        rtt->srtt8 += delta;
+        if (delta < 0) {
+            delta = -delta;
+        }
+        rtt->rttvar4 += delta - (rtt->rttvar4 >> 2);
+    }
+
+    // RTO = SRTT + max(G, 4 * RTTVAR), with a clock granularity G of 1 ms
+    rtt->rto = (rtt->srtt8 >> 3) + (rtt->rttvar4 > 1 ? rtt->rttvar4 : 1);
+    rtt->backoff = 0;
+    rtt_clamp(rtt);
+}
+
+/**
+ * Before the first sample, lower the RTO to what a sample of the given upper bound of the round-trip time would make
+ * it. SRTT and RTTVAR are left alone: a bound is not a measurement.
+ *
+ * @param   rtt         Pointer to estimator
+ * @param   bound       Round-trip time known not to be exceeded (ms)
+*/
+void rtt_seed(rtt_t *rtt, long bound) {
+    // SRTT + 4 * RTTVAR with SRTT = R, RTTVAR = R/2
+    long rto = 3 * (bound > 1 ? bound : 1);
+
+    if (rtt->has_sample || rto >= rtt->rto) {
+        return;
+    }
+    rtt->rto = rto;
+    rtt_clamp(rtt);
+}
+
+/**
+ * Double the RTO after a retransmission timeout (up to rto_max).
+ *
+ * @param   rtt         Pointer to estimator
+*/
+void rtt_backoff(rtt_t *rtt) {
+    if (rtt_rto(rtt) < rtt->rto_max) {
+        rtt->backoff++;
+    }
+}
+
+/**
+ * Undo the backoff after new data has been acknowledged.
+ *
+ * @param   rtt         Pointer to estimator
+*/
+void rtt_reset_backoff(rtt_t *rtt) {
+    rtt->backoff = 0;
+}
+
+/**
+ * Retrieve the current retransmission timeout.
+ *
+ * @param   rtt         Pointer to estimator
+ *
+ * @return  RTO in milliseconds
+*/
+long rtt_rto(rtt_t *rtt) {
+    long rto = rtt->rto << rtt->backoff;
+    return rto < rtt->rto_max ? rto : rtt->rto_max;
+}
+
+/**
+ * Retrieve the smoothed round-trip time.
+ *
+ * @param   rtt         Pointer to estimator
+ *
+ * @return  SRTT in milliseconds (0 if there has been no sample yet)
+*/
+long rtt_srtt(rtt_t *rtt) {
+    return rtt->srtt8 >> 3;
+}
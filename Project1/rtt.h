@@ -0,0 +1,88 @@
+#ifndef RTT_H
+#define RTT_H
+
+#include <stdint.h>
+
+/*
+ * Round-trip time estimator and retransmission timeout (RTO), following RFC 6298.
+ *
+ * The smoothed round-trip time (SRTT) and its variation (RTTVAR) are kept in milliseconds in fixed point, scaled by
+ * 8 and 4 respectively, like in the classic Jacobson/Karels implementation. Until the first sample arrives the RTO is
+ * the configured initial value (the -t option). Every retransmission timeout doubles the RTO (exponential backoff)
+ * until the next valid sample recomputes it, or an acknowledgement of new data shows that the path works again.
+ * The RTO is always clamped to [rto_min, rto_max].
+ *
+ * Samples must only be taken from packets that were never retransmitted (Karn's rule), since the ACK of a
+ * retransmitted packet cannot be matched to one particular transmission.
+*/
+
+typedef struct rtt {
+    long srtt8;         /* Smoothed round-trip time (ms), scaled by 8 */
+    long rttvar4;       /* Round-trip time variation (ms), scaled by 4 */
+    long rto;           /* Retransmission timeout before backoff (ms) */
+    int backoff;        /* Number of times the RTO has been doubled */
+    long rto_min;       /* Lower bound of the RTO (ms) */
+    long rto_max;       /* Upper bound of the RTO (ms) */
+    int has_sample;     /* Non-zero once the first sample has been taken */
+} rtt_t;
+
+/**
+ * Initialize the estimator.
+ *
+ * @param   rtt         Pointer to estimator
+ * @param   initial_rto RTO to use until the first sample (ms)
+ * @param   rto_min     Lower bound of the RTO (ms)
+ * @param   rto_max     Upper bound of the RTO (ms)
+*/
+void rtt_init(rtt_t *rtt, long initial_rto, long rto_min, long rto_max);
+
+/**
+ * Feed a round-trip time sample of a packet that was never retransmitted and recompute the RTO.
+ *
+ * @param   rtt         Pointer to estimator
+ * @param   sample      Measured round-trip time (ms)
+*/
+void rtt_sample(rtt_t *rtt, long sample);
+
+/**
+ * Before the first sample, lower the RTO to what a sample of the given upper bound of the round-trip time would make
+ * it. SRTT and RTTVAR are left alone: a bound is not a measurement.
+ *
+ * @param   rtt         Pointer to estimator
+ * @param   bound       Round-trip time known not to be exceeded (ms)
+*/
+void rtt_seed(rtt_t *rtt, long bound);
+
+/**
+ * Double the RTO after a retransmission timeout (up to rto_max).
+ *
+ * @param   rtt         Pointer to estimator
+*/
+void rtt_backoff(rtt_t *rtt);
+
+/**
+ * Undo the backoff after new data has been acknowledged.
+ *
+ * @param   rtt         Pointer to estimator
+*/
+void rtt_reset_backoff(rtt_t *rtt);
+
+/**
+ * Retrieve the current retransmission timeout.
+ *
+ * @param   rtt         Pointer to estimator
+ *
+ * @return  RTO in milliseconds
+*/
+long rtt_rto(rtt_t *rtt);
+
+/**
+ * Retrieve the smoothed round-trip time.
+ *
+ * @param   rtt         Pointer to estimator
+ *
+ * @return  SRTT in milliseconds (0 if there has been no sample yet)
+*/
+long rtt_srtt(rtt_t *rtt);
+
+#endif /* RTT_H */
@@ -0,0 +1,101 @@
+#ifndef SEQ_H
+#define SEQ_H
+
+#include <stdint.h>
+
+/*
+ * Sequence number arithmetic.
+ *
+ * Sequence numbers use the full 32 bits and wrap around from 0xffffffff to 0. They are compared as serial numbers
+ * (RFC 1982): a is before b iff b - a, taken modulo 2^32, lies in [1, 2^31). This is only meaningful for sequence
+ * numbers less than 2^31 apart, which always holds within the windows of a connection. Plain <, >, MIN and MAX must
+ * never be used on sequence numbers.
+ *
+ * Sequence number 0 marks a control packet (see ext.h), so data packets skip it when the numbers wrap: the number
+ * following 0xffffffff is 1. The distance between two sequence numbers still counts 0 as one packet, which at worst
+ * makes a window spanning the wrap one packet smaller.
+*/
+
+/**
+ * Check whether sequence number a comes before b.
+ *
+ * @param   a       Sequence number
+ * @param   b       Sequence number
+ *
+ * @return  Non-zero iff a < b in serial number arithmetic
+*/
+static inline int seq_lt(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+/**
+ * Check whether sequence number a comes before b or equals it.
+ *
+ * @param   a       Sequence number
+ * @param   b       Sequence number
+ *
+ * @return  Non-zero iff a <= b in serial number arithmetic
+*/
+static inline int seq_leq(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) <= 0;
+}
+
+/**
+ * Check whether sequence number a comes after b.
+ *
+ * @param   a       Sequence number
+ * @param   b       Sequence number
+ *
+ * @return  Non-zero iff a > b in serial number arithmetic
+*/
+static inline int seq_gt(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+/**
+ * Check whether sequence number a comes after b or equals it.
+ *
+ * @param   a       Sequence number
+ * @param   b       Sequence number
+ *
+ * @return  Non-zero iff a >= b in serial number arithmetic
+*/
+static inline int seq_geq(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) >= 0;
+}
+
+/**
+ * Retrieve the distance from sequence number b to a.
+ *
+ * @param   a       Sequence number
+ * @param   b       Sequence number
+ *
+ * @return  a - b, negative if a comes before b
+*/
+static inline int32_t seq_diff(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b);
+}
+
+/**
+ * Retrieve the data sequence number following the given one, skipping 0.
+ *
+ * @param   seqno   Sequence number
+ *
+ * @return  Next sequence number
+*/
+static inline uint32_t seq_next(uint32_t seqno) {
+    return seqno + 1 == 0 ? 1 : seqno + 1;
+}
+
+/**
+ * Retrieve the data sequence number preceding the given one, skipping 0.
+ *
+ * @param   seqno   Sequence number
+ *
+ * @return  Previous sequence number
+*/
+static inline uint32_t seq_prev(uint32_t seqno) {
+    return seqno - 1 == 0 ? 0xffffffff : seqno - 1;
+}
+
+#endif /* SEQ_H */
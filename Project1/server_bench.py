@@ -0,0 +1,108 @@
+import os
+import random
+import selectors
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+# Runs reliable as a server (-s) with 1, 2, 4, ... worker threads and measures the aggregate throughput of many
+# concurrent clients uploading a file through it into a TCP sink. Each client is a separate reliable process, so the
+# clients themselves scale across cores; the server only does if it has several threads.
+#
+# usage: python3 server_bench.py [reliable] [clients] [size-bytes] [window] [max-threads]
+
+
+class Sink(threading.Thread):
+    """Accepts TCP connections and counts the bytes received over all of them."""
+
+    def __init__(self):
+        threading.Thread.__init__(self, daemon=True)
+        self.listener = socket.socket()
+        self.listener.bind(("127.0.0.1", 0))
+        self.listener.listen(1024)
+        self.selector = selectors.DefaultSelector()
+        self.selector.register(self.listener, selectors.EVENT_READ)
+        self.received = 0
+        self.done = threading.Event()
+        self.expected = None
+
+    def port(self):
+        return self.listener.getsockname()[1]
+
+    def run(self):
+        while True:
+            for key, _ in self.selector.select():
+                if key.fileobj is self.listener:
+                    conn, _ = self.listener.accept()
+                    conn.setblocking(False)
+                    self.selector.register(conn, selectors.EVENT_READ)
+                    continue
+                try:
+                    data = key.fileobj.recv(65536)
+                except BlockingIOError:
+                    continue
+                if not data:
+                    self.selector.unregister(key.fileobj)
+                    key.fileobj.close()
+                    continue
+                self.received += len(data)
+                if self.expected is not None and self.received >= self.expected:
+                    self.done.set()
+
+
+def run(reliable, path, clients, size, window, threads):
+    sink = Sink()
+    sink.expected = clients * size
+    sink.start()
+    port = 20000 + random.randrange(20000)
+    server = subprocess.Popen([reliable, "-s", "--threads", str(threads), "-w", str(window),
+                               str(port), "localhost:%d" % sink.port()], stderr=subprocess.DEVNULL)
+    time.sleep(0.3)
+
+    start = time.time()
+    procs = []
+    for i in range(clients):
+        with open(path, "rb") as data:
+            procs.append(subprocess.Popen([reliable, "-w", str(window), str(port + 1 + i), "localhost:%d" % port],
+                                          stdin=data, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL))
+    finished = sink.done.wait(60)
+    elapsed = time.time() - start
+
+    for p in procs:
+        p.kill()
+        p.wait()
+    server.kill()
+    server.wait()
+    if not finished:
+        print("timed out: %d of %d bytes arrived" % (sink.received, sink.expected))
+        sys.exit(1)
+    return elapsed
+
+
+def main(reliable, clients, size, window, max_threads):
+    # All clients read the same file; each gets its own descriptor so that they do not share the offset
+    path = tempfile.mktemp()
+    with open(path, "wb") as f:
+        f.write(os.urandom(size))
+    print("%d clients uploading %d bytes each, window %d, %d CPUs" % (clients, size, window, os.cpu_count()))
+    print("%-8s  %10s  %12s" % ("threads", "time", "throughput"))
+    threads = 1
+    try:
+        while threads <= max_threads:
+            elapsed = run(reliable, path, clients, size, window, threads)
+            print("%-8d  %9.2fs  %8.1f MB/s" % (threads, elapsed, clients * size / elapsed / 1e6))
+            threads *= 2
+    finally:
+        os.unlink(path)
+
+
+if __name__ == "__main__":
+    reliable = sys.argv[1] if len(sys.argv) > 1 else "./reliable"
+    clients = int(sys.argv[2]) if len(sys.argv) > 2 else 32
+    size = int(sys.argv[3]) if len(sys.argv) > 3 else 1000000
+    window = int(sys.argv[4]) if len(sys.argv) > 4 else 32
+    max_threads = int(sys.argv[5]) if len(sys.argv) > 5 else 8
+    main(reliable, clients, size, window, max_threads)
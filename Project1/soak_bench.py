@@ -0,0 +1,103 @@
+import hashlib
+import random
+import re
+import struct
+import subprocess
+import sys
+import time
+
+# Pushes several GB through one connection between two instances of reliable at full speed and checks that every
+# byte arrives in order. The stream is generated on the fly (a counter in front of a fixed random block), so that
+# nothing is held in memory, and compared by its SHA-256 digest. By default the connection starts 2^22 packets before
+# the sequence numbers wrap around (--isn), so that a few GB run well past the wrap.
+#
+# The stream is generated by a second instance of this script (--feed), so that generating it never holds up reading
+# the output: a receiver whose output backs up drops packets.
+#
+# usage: python3 soak_bench.py [reliable] [gigabytes] [window] [isn] [reliable options...]
+
+BLOCK = 1 << 20
+STATS = re.compile(r"retransmitted (\d+) packets")
+
+
+def feed(blocks, seed):
+    """Writes the stream to standard output and its digest to standard error."""
+    body = random.Random(seed).randbytes(BLOCK - 8)
+    digest = hashlib.sha256()
+    try:
+        for i in range(blocks):
+            chunk = struct.pack(">Q", i) + body
+            digest.update(chunk)
+            sys.stdout.buffer.write(chunk)
+        sys.stdout.buffer.close()
+    except BrokenPipeError:
+        pass
+    sys.stderr.write(digest.hexdigest())
+
+
+def main(reliable, gigabytes, window, isn, extra):
+    blocks = int(gigabytes * 1024)
+    size = blocks * BLOCK
+    port_a = 20000 + random.randrange(20000)
+    port_b = port_a + 1
+    common = ["-w", str(window), "--isn", str(isn), "--stats"] + extra
+    print("%d bytes (%d packets), window %d, first seqno %d%s" % (size, (size + 499) // 500, window, isn,
+                                                                 "".join(" " + arg for arg in extra)))
+
+    # The receiver has nothing to send, but only sends its EOF once all data arrived: an EOF sent before the sender
+    # is listening would come back as ICMP port unreachable. The sender's output is discarded.
+    receiver = subprocess.Popen([reliable] + common + [str(port_b), "localhost:%d" % port_a],
+                                stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    time.sleep(0.2)
+    feeder = subprocess.Popen([sys.executable, __file__, "--feed", str(blocks), str(isn)],
+                              stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    sender = subprocess.Popen([reliable] + common + [str(port_a), "localhost:%d" % port_b],
+                              stdin=feeder.stdout, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    feeder.stdout.close()
+
+    received = hashlib.sha256()
+    total = 0
+    start = last = time.time()
+    while total < size:
+        chunk = receiver.stdout.read1(1 << 20)
+        if not chunk:
+            break
+        received.update(chunk)
+        total += len(chunk)
+        now = time.time()
+        if now - last >= 5:
+            print("  %6.2f GB  %8.1f MB/s" % (total / 2 ** 30, total / 2 ** 20 / (now - start)))
+            last = now
+    elapsed = time.time() - start
+    receiver.stdin.close()
+    sent = feeder.stderr.read().decode()
+    feeder.wait()
+
+    try:
+        sender.wait(timeout=10)
+    except subprocess.TimeoutExpired:
+        sender.kill()
+        sender.wait()
+    stderr = sender.stderr.read().decode()
+    receiver.kill()
+    receiver.wait()
+    receiver.stdout.close()
+
+    if total != size or received.hexdigest() != sent:
+        print("transfer corrupted: received %d of %d bytes, digest %s" % (total, size,
+                                                                         "ok" if received.hexdigest() == sent
+                                                                         else "mismatch"))
+        sys.exit(1)
+    match = STATS.search(stderr)
+    print("%.2f GB in %.1fs, %.1f MB/s, %s packets resent" % (size / 2 ** 30, elapsed, size / 2 ** 20 / elapsed,
+                                                              match.group(1) if match else "?"))
+
+
+if __name__ == "__main__" and sys.argv[1:2] == ["--feed"]:
+    feed(int(sys.argv[2]), int(sys.argv[3]))
+elif __name__ == "__main__":
+    reliable = sys.argv[1] if len(sys.argv) > 1 else "./reliable"
+    gigabytes = float(sys.argv[2]) if len(sys.argv) > 2 else 4
+    window = int(sys.argv[3]) if len(sys.argv) > 3 else 64
+    isn = int(sys.argv[4], 0) if len(sys.argv) > 4 else 2 ** 32 - 2 ** 22
+    main(reliable, gigabytes, window, isn, sys.argv[5:])
@@ -0,0 +1,125 @@
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from loss_bench import LossyRelay
+
+# Compares head-of-line blocking with and without --streams on a lossy path with some delay, through the relay of
+# loss_bench.py. Several flows write records to the sender at a steady rate, each record in a frame of its own flow's
+# stream (see --streams in rlib.h). Once as one byte stream, where a lost packet holds up every flow behind it, and
+# once as independent streams, where it only holds up its own. Reports how long records took from being written to
+# coming out of the receiver, and checks that every flow arrived complete and in order.
+#
+# usage: python3 stream_bench.py [reliable] [flows] [delay-ms] [window] [loss-percent...]
+
+RECORD = 400            # Bytes per record
+RECORDS = 2000          # Records sent, spread round-robin over the flows
+RECORD_GAP = 0.002      # Seconds between records
+
+
+def body(flow, index):
+    """The bytes of a record after its index and timestamp, different for every record."""
+    seed = (flow * 7919 + index) & 0xff
+    return bytes((seed + j) & 0xff for j in range(RECORD - 16))
+
+
+def run(reliable, flows, loss, delay, window, seed, extra):
+    port_a = 20000 + random.randrange(20000)
+    port_b = port_a + 1
+    relay = LossyRelay(port_a, port_b, loss, seed, delay)
+    relay.start()
+    # The receiver has nothing to send, the sender's output is discarded
+    receiver = subprocess.Popen([reliable, "-w", str(window)] + extra
+                                + [str(port_b), "localhost:%d" % relay.port(relay.side_b)],
+                                stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    log = tempfile.TemporaryFile()
+    sender = subprocess.Popen([reliable, "-w", str(window), "--stats"] + extra
+                              + [str(port_a), "localhost:%d" % relay.port(relay.side_a)],
+                              stdin=subprocess.PIPE, stdout=subprocess.DEVNULL, stderr=log)
+
+    def write():
+        begin = time.monotonic()
+        for i in range(RECORDS):
+            pause = begin + i * RECORD_GAP - time.monotonic()
+            if pause > 0:
+                time.sleep(pause)
+            flow = i % flows
+            record = struct.pack(">Qd", i // flows, time.monotonic()) + body(flow, i // flows)
+            sender.stdin.write(struct.pack(">HH", flow, RECORD) + record)
+            sender.stdin.flush()
+        sender.stdin.close()
+
+    writer = threading.Thread(target=write, daemon=True)
+    writer.start()
+
+    # Frames may split records (one frame per packet with --streams), so each flow is reassembled on its own
+    delays = []
+    pending = bytearray()
+    flow_bytes = [bytearray() for _ in range(flows)]
+    next_index = [0] * flows
+    while len(delays) < RECORDS:
+        chunk = receiver.stdout.read1(65536)
+        if not chunk:
+            break
+        now = time.monotonic()
+        pending += chunk
+        while len(pending) >= 4:
+            flow, length = struct.unpack(">HH", pending[:4])
+            if len(pending) < 4 + length:
+                break
+            if flow >= flows:
+                print("frame for unknown stream %d" % flow)
+                sys.exit(1)
+            data = flow_bytes[flow]
+            data += pending[4:4 + length]
+            del pending[:4 + length]
+            while len(data) >= RECORD:
+                index, stamp = struct.unpack(">Qd", data[:16])
+                if index != next_index[flow] or data[16:RECORD] != body(flow, index):
+                    print("stream %d corrupted: got record %d, expected %d" % (flow, index, next_index[flow]))
+                    sys.exit(1)
+                next_index[flow] += 1
+                delays.append((now - stamp) * 1000)
+                del data[:RECORD]
+    writer.join()
+
+    try:
+        sender.wait(timeout=10)
+    except subprocess.TimeoutExpired:
+        sender.kill()
+        sender.wait()
+    receiver.kill()
+    receiver.wait()
+    receiver.stdout.close()
+    relay.running = False
+    relay.join()
+    if len(delays) < RECORDS:
+        print("only %d of %d records arrived" % (len(delays), RECORDS))
+        sys.exit(1)
+    delays.sort()
+    return [delays[int(len(delays) * p / 100) - (p == 100)] for p in (50, 90, 99, 100)]
+
+
+def main(reliable, flows, delay_ms, window, losses):
+    print("%d flows, %d records of %d bytes every %g ms, %g ms each way, window %d"
+          % (flows, RECORDS, RECORD, RECORD_GAP * 1000, delay_ms, window))
+    print("%5s  %-11s  %9s  %9s  %9s  %9s" % ("loss", "mode", "p50", "p90", "p99", "max"))
+    for loss in losses:
+        for name, extra in (("one stream", []), ("streams", ["--streams", str(flows)])):
+            # With a single stream the frames travel as they were written, which is what the output shows, too
+            p50, p90, p99, worst = run(reliable, flows, loss / 100.0, delay_ms / 1000.0, window, int(loss * 100),
+                                       extra)
+            print("%4g%%  %-11s  %7.1fms  %7.1fms  %7.1fms  %7.1fms" % (loss, name, p50, p90, p99, worst))
+
+
+if __name__ == "__main__":
+    reliable = sys.argv[1] if len(sys.argv) > 1 else "./reliable"
+    flows = int(sys.argv[2]) if len(sys.argv) > 2 else 8
+    delay_ms = float(sys.argv[3]) if len(sys.argv) > 3 else 10
+    window = int(sys.argv[4]) if len(sys.argv) > 4 else 64
+    losses = [float(p) for p in sys.argv[5:]] or [1, 5]
+    main(reliable, flows, delay_ms, window, losses)
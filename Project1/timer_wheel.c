@@ -0,0 +1,260 @@
+#include <string.h>
+
+#include "timer_wheel.h"
+
+/* Number of milliseconds covered by one slot of the given level */
+#define TW_SLOT_SPAN(level) (1L << (TW_BITS * (level)))
+
+/* Furthest a timer can be placed ahead of the wheel's time */
+#define TW_RANGE (1L << (TW_BITS * TW_LEVELS))
+
+/**
+ * Put a timer into the slot matching its expiry time, relative to the wheel's current time.
+ * The caller guarantees expires >= wheel->now.
+ *
+ * @param   wheel       Pointer to wheel
+ * @param   timer       Pointer to timer
+*/
+static void tw_place(timer_wheel_t *wheel, tw_timer_t *timer) {
+    long expires = timer->expires;
+    long delta = expires - wheel->now;
+    int level = 0;
+    int index;
+
+    // Timers beyond the range of the wheel are parked at its far end and cascaded again from there
+    if (delta >= TW_RANGE) {
+        expires = wheel->now + TW_RANGE - 1;
+        delta = TW_RANGE - 1;
+    }
+    while (level < TW_LEVELS - 1 && delta >= TW_SLOT_SPAN(level + 1)) {
+        level++;
+    }
+    index = (expires >> (TW_BITS * level)) & TW_MASK;
+
+    timer->next = wheel->slots[level][index];
+    if (timer->next) {
+        timer->next->prev = &timer->next;
+    }
+    timer->prev = &wheel->slots[level][index];
+    wheel->slots[level][index] = timer;
+    wheel->occupied[level] |= (uint64_t)1 << index;
+    timer->wheel = wheel;
+    wheel->count++;
+}
+
+/**
+ * Take a timer out of its slot.
+ *
+ * @param   wheel       Pointer to wheel
+ * @param   timer       Pointer to pending timer
+*/
+static void tw_unlink(timer_wheel_t *wheel, tw_timer_t *timer) {
+    tw_timer_t** first = &wheel->slots[0][0];
+
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    *timer->prev = timer->next;
+
+    // If the timer was the head of its slot and the slot is now empty, clear its bit
+    if (timer->prev >= first && timer->prev < first + TW_LEVELS * TW_SIZE && *timer->prev == NULL) {
+        ptrdiff_t offset = timer->prev - first;
+        wheel->occupied[offset / TW_SIZE] &= ~((uint64_t)1 << (offset % TW_SIZE));
+    }
+
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->wheel = NULL;
+    wheel->count--;
+}
+
+/**
+ * Move all timers of the current slot of a level down into the lower levels.
+ *
+ * @param   wheel       Pointer to wheel
+ * @param   level       Level to cascade (>= 1)
+*/
+static void tw_cascade(timer_wheel_t *wheel, int level) {
+    int index = (wheel->now >> (TW_BITS * level)) & TW_MASK;
+    tw_timer_t* timer = wheel->slots[level][index];
+
+    wheel->slots[level][index] = NULL;
+    wheel->occupied[level] &= ~((uint64_t)1 << index);
+    while (timer) {
+        tw_timer_t* next = timer->next;
+        wheel->count--;
+        tw_place(wheel, timer);
+        timer = next;
+    }
+}
+
+/**
+ * Advance the wheel by one millisecond and run the timers due at that time.
+ *
+ * @param   wheel       Pointer to wheel
+*/
+static void tw_tick(timer_wheel_t *wheel) {
+    int level;
+    tw_timer_t** slot;
+
+    wheel->now++;
+
+    // At the start of a slot of a higher level, cascade it (highest first, so nothing lands behind a cascade)
+    for (level = TW_LEVELS - 1; level > 0; level--) {
+        if ((wheel->now & (TW_SLOT_SPAN(level) - 1)) == 0) {
+            tw_cascade(wheel, level);
+        }
+    }
+
+    // Run the timers one at a time, callbacks may cancel others from the same slot
+    slot = &wheel->slots[0][wheel->now & TW_MASK];
+    while (*slot) {
+        tw_timer_t* timer = *slot;
+        tw_unlink(wheel, timer);
+        timer->fn(timer, timer->arg);
+    }
+}
+
+/**
+ * Find the first occupied slot after the current one on a level.
+ *
+ * @param   wheel       Pointer to wheel
+ * @param   level       Level to search
+ *
+ * @return  Number of slots ahead (1 to TW_SIZE), 0 if the level is empty
+*/
+static int tw_first_occupied(timer_wheel_t *wheel, int level) {
+    uint64_t bits = wheel->occupied[level];
+    int current = (wheel->now >> (TW_BITS * level)) & TW_MASK;
+    int shift = (current + 1) & TW_MASK;
+
+    if (bits == 0) {
+        return 0;
+    }
+    // Rotate so that bit 0 is the slot right after the current one
+    if (shift) {
+        bits = (bits >> shift) | (bits << (TW_SIZE - shift));
+    }
+    return __builtin_ctzll(bits) + 1;
+}
+
+/**
+ * Initialize an empty wheel.
+ *
+ * @param   wheel       Pointer to wheel
+ * @param   now         Current time in milliseconds
+*/
+void timer_wheel_init(timer_wheel_t *wheel, long now) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+/**
+ * Initialize a timer (not pending).
+ *
+ * @param   timer       Pointer to timer
+ * @param   fn          Callback invoked on expiry
+ * @param   arg         Argument passed to the callback
+*/
+void tw_timer_init(tw_timer_t *timer, tw_callback_t fn, void *arg) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->wheel = NULL;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+}
+
+/**
+ * Schedule a timer, rescheduling it if it is already pending.
+ * A timer that is already due runs on the next advance of the wheel.
+ *
+ * @param   wheel       Pointer to wheel
+ * @param   timer       Pointer to timer
+ * @param   expires     Absolute expiry time in milliseconds
+*/
+void tw_timer_add(timer_wheel_t *wheel, tw_timer_t *timer, long expires) {
+    if (timer->wheel) {
+        tw_unlink(timer->wheel, timer);
+    }
+    // The slot of the current time has already been run
+    timer->expires = expires > wheel->now ? expires : wheel->now + 1;
+    tw_place(wheel, timer);
+}
+
+/**
+ * Cancel a timer. Does nothing if the timer is not pending.
+ *
+ * @param   timer       Pointer to timer
+*/
+void tw_timer_del(tw_timer_t *timer) {
+    if (timer->wheel) {
+        tw_unlink(timer->wheel, timer);
+    }
+}
+
+/**
+ * Check whether a timer is pending.
+ *
+ * @param   timer       Pointer to timer
+ *
+ * @return  1 iff the timer is pending, 0 otherwise
+*/
+int tw_timer_pending(tw_timer_t *timer) {
+    return timer->wheel != NULL;
+}
+
+/**
+ * Advance the wheel to the given time and run all timers due until then.
+ * Callbacks may add and cancel any timers, including their own.
+ *
+ * @param   wheel       Pointer to wheel
+ * @param   now         Current time in milliseconds
+*/
+void timer_wheel_run(timer_wheel_t *wheel, long now) {
+    while (wheel->now < now) {
+        if (wheel->count == 0) {
+            wheel->now = now;
+            break;
+        }
+        // Nothing on level 0: skip ahead to the end of its rotation, where the next cascade happens
+        if (wheel->occupied[0] == 0) {
+            long skip_to = wheel->now | TW_MASK;
+            if (skip_to >= now) {
+                wheel->now = now;
+                break;
+            }
+            wheel->now = skip_to;
+        }
+        tw_tick(wheel);
+    }
+}
+
+/**
+ * Retrieve the time at which the wheel next needs to be advanced.
+ * This is the exact expiry time for timers due within TW_SIZE milliseconds, and the time of the next cascade
+ * (which is never later than the expiry time) for timers further out.
+ *
+ * @param   wheel       Pointer to wheel
+ *
+ * @return  Absolute time in milliseconds (-1 if no timer is pending)
+*/
+long timer_wheel_next(timer_wheel_t *wheel) {
+    long next = -1;
+    int level;
+
+    if (wheel->count == 0) {
+        return -1;
+    }
+    for (level = 0; level < TW_LEVELS; level++) {
+        int ahead = tw_first_occupied(wheel, level);
+        if (ahead) {
+            // Start of the occupied slot, which for level 0 is the expiry time itself
+            long when = ((wheel->now >> (TW_BITS * level)) + ahead) << (TW_BITS * level);
+            if (next < 0 || when < next) {
+                next = when;
+            }
+        }
+    }
+    return next;
+}
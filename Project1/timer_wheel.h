@@ -0,0 +1,110 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * A hierarchical timer wheel with a resolution of one millisecond.
+ *
+ * The wheel has TW_LEVELS levels of TW_SIZE slots each. Level 0 holds the timers due within the next TW_SIZE
+ * milliseconds, one slot per millisecond; every further level covers TW_SIZE times the range of the previous one with
+ * slots TW_SIZE times as wide. When the wheel reaches the start of a slot on a higher level, the timers in it are
+ * cascaded down into the lower levels. Timers further out than the top level can reach are parked in it and cascaded
+ * again until they are due.
+ *
+ * Adding and cancelling a timer is O(1), and advancing the wheel only touches the timers that expire (plus the
+ * cascades). Every level keeps a bitmap of its occupied slots, so the next deadline is found without scanning slots.
+ *
+ * Timers are intrusive: a tw_timer_t is embedded in whatever it times, and its callback gets the timer itself plus
+ * the argument it was initialized with. A pending timer knows its wheel, so it can be cancelled on its own.
+*/
+
+#define TW_BITS 6
+#define TW_SIZE (1 << TW_BITS)
+#define TW_MASK (TW_SIZE - 1)
+#define TW_LEVELS 4
+
+struct tw_timer;
+typedef void (*tw_callback_t)(struct tw_timer *timer, void *arg);
+
+typedef struct tw_timer {
+    struct tw_timer* next;          /* Next timer in the same slot */
+    struct tw_timer** prev;         /* Link pointing to this timer */
+    struct timer_wheel* wheel;      /* Wheel the timer is pending on (NULL if not pending) */
+    long expires;                   /* Absolute expiry time in milliseconds */
+    tw_callback_t fn;               /* Called when the timer expires */
+    void* arg;                      /* Argument for fn */
+} tw_timer_t;
+
+typedef struct timer_wheel {
+    long now;                               /* Time up to which all due timers have been run (ms) */
+    tw_timer_t* slots[TW_LEVELS][TW_SIZE];  /* Pending timers per level and slot */
+    uint64_t occupied[TW_LEVELS];           /* Bitmap of non-empty slots per level */
+    uint32_t count;                         /* Number of pending timers */
+} timer_wheel_t;
+
+/**
+ * Initialize an empty wheel.
+ *
+ * @param   wheel       Pointer to wheel
+ * @param   now         Current time in milliseconds
+*/
+void timer_wheel_init(timer_wheel_t *wheel, long now);
+
+/**
+ * Initialize a timer (not pending).
+ *
+ * @param   timer       Pointer to timer
+ * @param   fn          Callback invoked on expiry
+ * @param   arg         Argument passed to the callback
+*/
+void tw_timer_init(tw_timer_t *timer, tw_callback_t fn, void *arg);
+
+/**
+ * Schedule a timer, rescheduling it if it is already pending.
+ * A timer that is already due runs on the next advance of the wheel.
+ *
+ * @param   wheel       Pointer to wheel
+ * @param   timer       Pointer to timer
+ * @param   expires     Absolute expiry time in milliseconds
+*/
+void tw_timer_add(timer_wheel_t *wheel, tw_timer_t *timer, long expires);
+
+/**
+ * Cancel a timer. Does nothing if the timer is not pending.
+ *
+ * @param   timer       Pointer to timer
+*/
+void tw_timer_del(tw_timer_t *timer);
+
+/**
+ * Check whether a timer is pending.
+ *
+ * @param   timer       Pointer to timer
+ *
+ * @return  1 iff the timer is pending, 0 otherwise
+*/
+int tw_timer_pending(tw_timer_t *timer);
+
+/**
+ * Advance the wheel to the given time and run all timers due until then.
+ * Callbacks may add and cancel any timers, including their own.
+ *
+ * @param   wheel       Pointer to wheel
+ * @param   now         Current time in milliseconds
+*/
+void timer_wheel_run(timer_wheel_t *wheel, long now);
+
+/**
+ * Retrieve the time at which the wheel next needs to be advanced.
+ * This is the exact expiry time for timers due within TW_SIZE milliseconds, and the time of the next cascade
+ * (which is never later than the expiry time) for timers further out.
+ *
+ * @param   wheel       Pointer to wheel
+ *
+ * @return  Absolute time in milliseconds (-1 if no timer is pending)
+*/
+long timer_wheel_next(timer_wheel_t *wheel);
+
+#endif /* TIMER_WHEEL_H */
@@ -0,0 +1,75 @@
+import os
+import random
+import subprocess
+import sys
+import time
+
+from loss_bench import LossyRelay
+
+# Measures how long short request-sized transfers take on a lossy path with some delay, with and without tail loss
+# probes (--tlp), through the relay of loss_bench.py. One connection carries a series of bursts: each burst is written
+# to the sender at once and timed until its last byte came out of the receiver, then the connection idles briefly so
+# that the next burst starts with nothing in flight. A packet lost at the end of a burst has no later packets to
+# produce duplicate acknowledgements, so without probes it waits for a retransmission timeout.
+#
+# usage: python3 tlp_bench.py [reliable] [delay-ms] [burst-bytes] [bursts] [rto-min-ms] [loss-percent...]
+
+WINDOW = 32
+IDLE = 0.02             # Seconds between bursts
+
+
+def run(reliable, loss, delay, burst, bursts, rto_min, seed, extra):
+    port_a = 20000 + random.randrange(20000)
+    port_b = port_a + 1
+    relay = LossyRelay(port_a, port_b, loss, seed, delay)
+    relay.start()
+    common = ["-w", str(WINDOW), "--rto-min", str(rto_min)] + extra
+    # The receiver has nothing to send, the sender's output is discarded
+    receiver = subprocess.Popen([reliable] + common + [str(port_b), "localhost:%d" % relay.port(relay.side_b)],
+                                stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    sender = subprocess.Popen([reliable] + common + [str(port_a), "localhost:%d" % relay.port(relay.side_a)],
+                              stdin=subprocess.PIPE, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    times = []
+    for i in range(bursts):
+        data = os.urandom(burst)
+        start = time.monotonic()
+        sender.stdin.write(data)
+        sender.stdin.flush()
+        received = bytearray()
+        while len(received) < burst:
+            chunk = receiver.stdout.read1(65536)
+            if not chunk:
+                break
+            received += chunk
+        times.append((time.monotonic() - start) * 1000)
+        if received != data:
+            print("burst %d corrupted: received %d of %d bytes" % (i, len(received), burst))
+            sys.exit(1)
+        time.sleep(IDLE)
+    for process in (sender, receiver):
+        process.kill()
+        process.wait()
+    relay.running = False
+    relay.join()
+    times.sort()
+    return [sum(times) / len(times)] + [times[int(len(times) * p / 100) - (p == 100)] for p in (50, 99, 100)]
+
+
+def main(reliable, delay_ms, burst, bursts, rto_min, losses):
+    print("%d bursts of %d bytes, %g ms each way, window %d, rto-min %d ms" % (bursts, burst, delay_ms, WINDOW, rto_min))
+    print("%5s  %-6s  %9s  %9s  %9s  %9s" % ("loss", "mode", "mean", "p50", "p99", "max"))
+    for loss in losses:
+        for name, extra in (("rto", []), ("tlp", ["--tlp"])):
+            mean, p50, p99, worst = run(reliable, loss / 100.0, delay_ms / 1000.0, burst, bursts, rto_min,
+                                        int(loss * 100), extra)
+            print("%4g%%  %-6s  %7.1fms  %7.1fms  %7.1fms  %7.1fms" % (loss, name, mean, p50, p99, worst))
+
+
+if __name__ == "__main__":
+    reliable = sys.argv[1] if len(sys.argv) > 1 else "./reliable"
+    delay_ms = float(sys.argv[2]) if len(sys.argv) > 2 else 10
+    burst = int(sys.argv[3]) if len(sys.argv) > 3 else 10240
+    bursts = int(sys.argv[4]) if len(sys.argv) > 4 else 300
+    rto_min = int(sys.argv[5]) if len(sys.argv) > 5 else 200
+    losses = [float(p) for p in sys.argv[6:]] or [1, 5, 10]
+    main(reliable, delay_ms, burst, bursts, rto_min, losses)